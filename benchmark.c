@@ -0,0 +1,617 @@
+/* A single benchmark driver for the kernels of both local_qft.c and
+ * local_controls.c, running the full cartesian product of a sweep spec (kernels,
+ * qubit counts, thread counts, targets or control counts, and repetitions) in
+ * one process. One statevector, of the largest size, is allocated for the
+ * whole sweep. Every finished configuration is appended to a checkpoint file,
+ * and configurations already present in it are skipped, so an interrupted sweep
+ * resumes where it stopped; the association output is written from the
+ * checkpoint once the sweep completes. A checkpoint recorded with other reps,
+ * warmups, flush, counters or PRECISION is refused rather than mixed in.
+ *
+ * A spec file holds one "key = values" line per parameter, where values are
+ * separated by spaces and may include inclusive ranges like 20:30, and # begins
+ * a comment. Omitted keys take the defaults below:
+ *
+ *      kernels = H P S MT qftBlocked s_D m_E
+ *      qubits = 20:24
+ *      threads = 1 2 4
+ *      targets = all       # the target (or control) qubits of the gate kernels
+ *      ctrls = 2:8         # the numbers of controls of the m_ kernels
+ *      reps = 5
+ *      warmups = 1
+ *      flush = 1
+ *      out = sweep.txt     # or e.g. sweep.bin, for the binary format of binformatter.h
+ *      checkpoint = sweep.ckpt
+ *
+ * The kernels are named as in the other benchmarks: the gates H, P, S, M, MT,
+ * HG and SG; the QFTs qftCircuit, qftAlgorithm, qftTabled, qftBlocked and
+ * qftFused; and the control methods s_X and m_X of local_controls.c.
+ *
+ * It is important that inline functions are actually inlined, so pass optimisation
+ * flags (especially with Clang)
+ * run with:
+ *      gcc benchmark.c -O3 -lm -fopenmp -march=native -o bench
+ *      ./bench spec.txt
+ */
+
+#ifdef EXCLUDE_MAIN
+#include "local_qft.c"
+#include "local_controls.c"
+#else
+#define EXCLUDE_MAIN
+#include "local_qft.c"
+#include "local_controls.c"
+#undef EXCLUDE_MAIN
+#endif
+
+#include <ctype.h>
+
+
+
+/* kernel registry */
+
+typedef enum {
+    PARAM_NONE,         // a whole QFT
+    PARAM_TARGET,       // a gate's target, or a single control qubit
+    PARAM_NUM_CTRLS     // the number of random controls
+} ParamKind;
+
+#define NUM_QFT_GATE_KERNELS 7
+char* qftGateKernelNames[NUM_QFT_GATE_KERNELS] = {"H", "P", "S", "M", "MT", "HG", "SG"};
+
+#define NUM_QFT_KERNELS 5
+char* qftKernelNames[NUM_QFT_KERNELS] = {"qftCircuit", "qftAlgorithm", "qftTabled", "qftBlocked", "qftFused"};
+
+typedef struct {
+
+    char name[32];
+    ParamKind param;
+    int usesReals;      // the control methods modify a real array, rather than amps
+    int index;          // into the kernel family's own arrays
+
+} DriverKernel;
+
+int getDriverKernel(char* name, DriverKernel* kernel) {
+
+    // returns 0 if name is unrecognised
+    snprintf(kernel->name, sizeof kernel->name, "%s", name);
+    kernel->usesReals = 0;
+
+    for (int k=0; k<NUM_QFT_GATE_KERNELS; k++)
+        if (strcmp(name, qftGateKernelNames[k]) == 0) {
+            kernel->param = PARAM_TARGET;
+            kernel->index = k;
+            return 1;
+        }
+    for (int k=0; k<NUM_QFT_KERNELS; k++)
+        if (strcmp(name, qftKernelNames[k]) == 0) {
+            kernel->param = PARAM_NONE;
+            kernel->index = NUM_QFT_GATE_KERNELS + k;
+            return 1;
+        }
+
+    kernel->usesReals = 1;
+    if (strncmp(name, "s_", 2) == 0) {
+        kernel->param = PARAM_TARGET;
+        kernel->index = getMethodIndex(s_methodNames, NUM_S_METHODS, &name[2]);
+        return kernel->index >= 0;
+    }
+    if (strncmp(name, "m_", 2) == 0) {
+        kernel->param = PARAM_NUM_CTRLS;
+        kernel->index = getMethodIndex(m_methodNames, NUM_M_METHODS, &name[2]);
+        return kernel->index >= 0;
+    }
+    return 0;
+}
+
+void applyDriverKernel(DriverKernel* kernel, void* state, int param, int* ctrls, int N) {
+
+    amp* psi = state;
+    qreal* reals = state;
+    INDEX numReals = pow2(N);
+
+    // QFT gates pair the target with its swap partner, as in applyScalingKernel
+    int t = param;
+    int p = (t == N-t-1)? (t+1)%N : N-t-1;
+
+    if (kernel->param == PARAM_NUM_CTRLS) {
+        m_methods[kernel->index](reals, numReals, ctrls, param);
+        return;
+    }
+    if (kernel->usesReals) {
+        s_methods[kernel->index](reals, numReals, param);
+        return;
+    }
+
+    switch (kernel->index) {
+        case 0: applyHadamard(psi, t, N); break;
+        case 1: applyControlledPhase(psi, t, p, M_PI/4, N); break;
+        case 2: applySwap(psi, t, p, N); break;
+        case 3: applyMergedPhases(psi, t, N); break;
+        case 4: applyMergedPhasesTabled(psi, t, N); break;
+        case 5: applyGenericHadamard(psi, t, N); break;
+        case 6: applyGenericSwap(psi, t, p, N); break;
+        case 7: applyQFTCircuit(psi, N); break;
+        case 8: applyQFTAlgorithm(psi, N); break;
+        case 9: applyQFTAlgorithmTabled(psi, N); break;
+        case 10: applyQFTBlocked(psi, N); break;
+        case 11: applyQFTAlgorithmFused(psi, N); break;
+    }
+}
+
+
+
+/* sweep spec */
+
+#define MAX_SPEC_VALUES 256
+#define MAX_SPEC_LINE 4096
+
+typedef struct {
+
+    int numKernels;
+    DriverKernel kernels[MAX_SPEC_VALUES];
+
+    int numQubitCounts;
+    int qubitCounts[MAX_SPEC_VALUES];
+
+    int numThreadCounts;
+    int threadCounts[MAX_SPEC_VALUES];
+
+    int allTargets;
+    int numTargets;
+    int targets[MAX_SPEC_VALUES];
+
+    int numCtrlCounts;
+    int ctrlCounts[MAX_SPEC_VALUES];
+
+    int numReps;
+    int numWarmups;
+    int flushCache;
+
+    char outFN[MAX_SPEC_LINE];
+    char checkpointFN[MAX_SPEC_LINE];
+
+} SweepSpec;
+
+int parseSpecInts(char* values, int* arr) {
+
+    // parses space-separated integers and inclusive ranges a:b, returning the count
+    int num = 0;
+    for (char* tok = strtok(values, " \t"); tok != NULL; tok = strtok(NULL, " \t")) {
+        int lo, hi;
+        if (sscanf(tok, "%d:%d", &lo, &hi) != 2)
+            hi = lo = atoi(tok);
+        for (int v=lo; v<=hi && num<MAX_SPEC_VALUES; v++)
+            arr[num++] = v;
+    }
+    return num;
+}
+
+void setDefaultSweepSpec(SweepSpec* spec) {
+
+    char kernels[] = "H P S MT qftBlocked s_D m_E";
+    spec->numKernels = 0;
+    for (char* tok = strtok(kernels, " "); tok != NULL; tok = strtok(NULL, " "))
+        getDriverKernel(tok, &spec->kernels[spec->numKernels++]);
+
+    char qubits[] = "20:24", threads[] = "1 2 4", ctrls[] = "2:8";
+    spec->numQubitCounts = parseSpecInts(qubits, spec->qubitCounts);
+    spec->numThreadCounts = parseSpecInts(threads, spec->threadCounts);
+    spec->numCtrlCounts = parseSpecInts(ctrls, spec->ctrlCounts);
+    spec->allTargets = 1;
+    spec->numTargets = 0;
+
+    spec->numReps = 5;
+    spec->numWarmups = 1;
+    spec->flushCache = 1;
+    strcpy(spec->outFN, "sweep.txt");
+    strcpy(spec->checkpointFN, "sweep.ckpt");
+}
+
+int loadSweepSpec(char* specFN, SweepSpec* spec) {
+
+    // returns 0 (having printed why) if the spec is unreadable or invalid
+    setDefaultSweepSpec(spec);
+    FILE* file = fopen(specFN, "r");
+    if (file == NULL) {
+        printf("could not open spec %s\n", specFN);
+        return 0;
+    }
+
+    char line[MAX_SPEC_LINE];
+    while (fgets(line, sizeof line, file) != NULL) {
+
+        // strip the comment and trailing whitespace, skipping blank lines
+        char* hash = strchr(line, '#');
+        if (hash != NULL)
+            *hash = '\0';
+        char* eq = strchr(line, '=');
+        if (eq == NULL)
+            continue;
+        *eq = '\0';
+
+        char key[MAX_SPEC_LINE];
+        char* values = eq + 1;
+        if (sscanf(line, "%s", key) != 1)
+            continue;
+        for (int i=strlen(values)-1; i>=0 && isspace(values[i]); i--)
+            values[i] = '\0';
+
+        if (strcmp(key, "kernels") == 0) {
+            spec->numKernels = 0;
+            for (char* tok = strtok(values, " \t"); tok != NULL; tok = strtok(NULL, " \t")) {
+                if (spec->numKernels == MAX_SPEC_VALUES || !getDriverKernel(tok, &spec->kernels[spec->numKernels])) {
+                    printf("unknown kernel %s\n", tok);
+                    fclose(file);
+                    return 0;
+                }
+                spec->numKernels++;
+            }
+        }
+        else if (strcmp(key, "qubits") == 0)
+            spec->numQubitCounts = parseSpecInts(values, spec->qubitCounts);
+        else if (strcmp(key, "threads") == 0)
+            spec->numThreadCounts = parseSpecInts(values, spec->threadCounts);
+        else if (strcmp(key, "targets") == 0) {
+            spec->allTargets = (strstr(values, "all") != NULL);
+            spec->numTargets = spec->allTargets? 0 : parseSpecInts(values, spec->targets);
+        }
+        else if (strcmp(key, "ctrls") == 0)
+            spec->numCtrlCounts = parseSpecInts(values, spec->ctrlCounts);
+        else if (strcmp(key, "reps") == 0)
+            spec->numReps = atoi(values);
+        else if (strcmp(key, "warmups") == 0)
+            spec->numWarmups = atoi(values);
+        else if (strcmp(key, "flush") == 0)
+            spec->flushCache = atoi(values);
+        else if (strcmp(key, "out") == 0)
+            sscanf(values, "%s", spec->outFN);
+        else if (strcmp(key, "checkpoint") == 0)
+            sscanf(values, "%s", spec->checkpointFN);
+        else {
+            printf("unknown spec key %s\n", key);
+            fclose(file);
+            return 0;
+        }
+    }
+    fclose(file);
+
+    if (spec->numKernels == 0 || spec->numQubitCounts == 0 || spec->numThreadCounts == 0 || spec->numReps < 1) {
+        printf("the spec must give at least one kernel, qubit count, thread count and rep\n");
+        return 0;
+    }
+    return 1;
+}
+
+int getSweepParams(SweepSpec* spec, DriverKernel* kernel, int N, int* params) {
+
+    // the kernel's params for an N-qubit statevector, returning the count
+    int num = 0;
+    if (kernel->param == PARAM_NONE)
+        params[num++] = 0;
+    else if (kernel->param == PARAM_TARGET && spec->allTargets) {
+        for (int t=0; t<N; t++)
+            params[num++] = t;
+    } else if (kernel->param == PARAM_TARGET) {
+        for (int i=0; i<spec->numTargets; i++)
+            if (spec->targets[i] >= 0 && spec->targets[i] < N)
+                params[num++] = spec->targets[i];
+    } else {
+        for (int i=0; i<spec->numCtrlCounts; i++)
+            if (spec->ctrlCounts[i] >= 2 && spec->ctrlCounts[i] <= N)
+                params[num++] = spec->ctrlCounts[i];
+    }
+    return num;
+}
+
+
+
+/* checkpointing */
+
+/* the first line of the checkpoint records the settings shared by every
+ * configuration, which a resumed sweep must match, as
+ *      # reps R warmups W flush F events E precision P
+ * and each subsequent line records one finished configuration, as
+ *      kernel numQubits numThreads param  mean var min median max p5 p95 bandwidth throughput hasEvents events...
+ */
+
+typedef struct {
+
+    char kernel[32];
+    int numQubits;
+    int numThreads;
+    int param;
+    HarnessStats stats;
+
+} SweepRecord;
+
+typedef struct {
+
+    SweepRecord* records;
+    int numRecords;
+    int capacity;
+
+} SweepResults;
+
+void addSweepRecord(SweepResults* results, SweepRecord rec) {
+
+    if (results->numRecords == results->capacity) {
+        results->capacity = (results->capacity == 0)? 64 : 2 * results->capacity;
+        results->records = realloc(results->records, results->capacity * sizeof *results->records);
+    }
+    results->records[results->numRecords++] = rec;
+}
+
+SweepRecord* findSweepRecord(SweepResults* results, char* kernel, int N, int numThreads, int param) {
+
+    for (int r=0; r<results->numRecords; r++) {
+        SweepRecord* rec = &results->records[r];
+        if (strcmp(rec->kernel, kernel) == 0 && rec->numQubits == N && rec->numThreads == numThreads && rec->param == param)
+            return rec;
+    }
+    return NULL;
+}
+
+void getCheckpointHeader(SweepSpec* spec, char* header) {
+    sprintf(header, "# reps %d warmups %d flush %d events %d precision %s\n",
+        spec->numReps, spec->numWarmups, spec->flushCache, HARNESS_COUNT_EVENTS, PRECISION_NAME);
+}
+
+int loadCheckpoint(SweepSpec* spec, SweepResults* results) {
+
+    // a missing (or empty) checkpoint is a fresh sweep, and a truncated last line
+    // is discarded. Returns 0 if the checkpoint was recorded with other settings
+    char* checkpointFN = spec->checkpointFN;
+    char header[MAX_SPEC_LINE];
+    getCheckpointHeader(spec, header);
+
+    char line[MAX_SPEC_LINE];
+    FILE* file = fopen(checkpointFN, "r");
+    if (file == NULL || fgets(line, sizeof line, file) == NULL) {
+        if (file != NULL)
+            fclose(file);
+        file = fopen(checkpointFN, "w");
+        fputs(header, file);
+        fclose(file);
+        return 1;
+    }
+    if (strcmp(line, header) != 0) {
+        printf("checkpoint %s was recorded with other settings than\n\t%s"
+            "so cannot be resumed; delete it, or name a new checkpoint\n", checkpointFN, header);
+        fclose(file);
+        return 0;
+    }
+
+    int isTerminated = 1;
+    while (fgets(line, sizeof line, file) != NULL) {
+        isTerminated = (strchr(line, '\n') != NULL);
+        SweepRecord rec;
+        HarnessStats* s = &rec.stats;
+        int numRead = sscanf(line, "%31s %d %d %d %lf %lf %lf %lf %lf %lf %lf %lf %lf %d %lf %lf %lf %lf %lf",
+            rec.kernel, &rec.numQubits, &rec.numThreads, &rec.param,
+            &s->mean, &s->var, &s->min, &s->median, &s->max, &s->p5, &s->p95,
+            &s->bandwidth, &s->throughput, &s->hasEvents,
+            &s->events[0], &s->events[1], &s->events[2], &s->events[3], &s->events[4]);
+        if (numRead == 14 + NUM_PERF_EVENTS && isTerminated)
+            addSweepRecord(results, rec);
+    }
+    fclose(file);
+
+    // ends an interrupted line, so that it does not corrupt the next record
+    if (!isTerminated) {
+        file = fopen(checkpointFN, "a");
+        fprintf(file, "\n");
+        fclose(file);
+    }
+    return 1;
+}
+
+void appendCheckpoint(char* checkpointFN, SweepRecord* rec) {
+
+    // flushed immediately, so that only the configuration in progress can be lost
+    FILE* file = fopen(checkpointFN, "a");
+    HarnessStats* s = &rec->stats;
+    fprintf(file, "%s %d %d %d %.17g %.17g %.17g %.17g %.17g %.17g %.17g %.17g %.17g %d",
+        rec->kernel, rec->numQubits, rec->numThreads, rec->param,
+        s->mean, s->var, s->min, s->median, s->max, s->p5, s->p95,
+        s->bandwidth, s->throughput, s->hasEvents);
+    for (int e=0; e<NUM_PERF_EVENTS; e++)
+        fprintf(file, " %.17g", s->events[e]);
+    fprintf(file, "\n");
+    fclose(file);
+}
+
+
+
+/* output */
+
+int isBinaryResultsFN(char* outFN) {
+
+    // results are written by binformatter.h rather than as an association
+    size_t len = strlen(outFN);
+    return len > 4 && strcmp(&outFN[len-4], ".bin") == 0;
+}
+
+void writeSweepResults(SweepSpec* spec, SweepResults* results) {
+
+    /* every (kernel, numQubits, numThreads) run is written as harness statistic
+     * arrays over its params, keyed e.g. med_H_24q_4t, alongside the params
+     * themselves, keyed e.g. params_H_24q_4t. An outFN ending in .bin is
+     * written in the binary format with the same keys, and exactly rather
+     * than at outPrec digits
+     */
+    int outPrec = 5;
+    int isBinary = isBinaryResultsFN(spec->outFN);
+    char* note = "timings are already per-rep; params are targets, controls, or numbers of controls";
+
+    FILE* file = isBinary? openBinaryWrite(spec->outFN) : openAssocWrite(spec->outFN);
+    if (isBinary) {
+        writeStringToBinary(file, "note", note);
+        writeStringToBinary(file, "precision", PRECISION_NAME);
+        writeIntToBinary(file, "numReps", spec->numReps);
+        writeIntToBinary(file, "numWarmups", spec->numWarmups);
+    } else {
+        writeStringToAssoc(file, "note", note);
+        writeStringToAssoc(file, "precision", PRECISION_NAME);
+        writeIntToAssoc(file, "numReps", spec->numReps);
+        writeIntToAssoc(file, "numWarmups", spec->numWarmups);
+        writeIntToAssoc(file, "outPrec", outPrec);
+    }
+
+    for (int q=0; q<spec->numQubitCounts; q++) {
+        int N = spec->qubitCounts[q];
+        for (int th=0; th<spec->numThreadCounts; th++) {
+            int numThreads = spec->threadCounts[th];
+            for (int k=0; k<spec->numKernels; k++) {
+                DriverKernel* kernel = &spec->kernels[k];
+                int params[MAX_SPEC_VALUES > N? MAX_SPEC_VALUES : N];
+                int numParams = getSweepParams(spec, kernel, N, params);
+                if (numParams == 0)
+                    continue;
+
+                HarnessStats stats[numParams];
+                for (int i=0; i<numParams; i++) {
+                    SweepRecord* rec = findSweepRecord(results, kernel->name, N, numThreads, params[i]);
+                    stats[i] = (rec != NULL)? rec->stats : getEmptyHarnessStats();
+                }
+
+                char name[100];
+                sprintf(name, "%s_%dq_%dt", kernel->name, N, numThreads);
+                char key[110];
+                sprintf(key, "params_%s", name);
+                if (isBinary) {
+                    writeIntArrToBinary(file, key, params, numParams);
+                    writeHarnessStatsArrToBinary(file, name, stats, numParams);
+                } else {
+                    writeIntArrToAssoc(file, key, params, numParams);
+                    writeHarnessStatsArrToAssoc(file, name, stats, numParams, outPrec);
+                }
+            }
+        }
+    }
+
+    if (isBinary)
+        closeBinaryWrite(file);
+    else
+        closeAssocWrite(file);
+}
+
+
+
+/* sweeping */
+
+void setDriverThreads(int numThreads) {
+#ifdef _OPENMP
+    omp_set_num_threads(numThreads);
+#endif
+}
+
+void runSweep(SweepSpec* spec) {
+
+    SweepResults results = {.records = NULL, .numRecords = 0, .capacity = 0};
+    if (!loadCheckpoint(spec, &results))
+        return;
+    if (results.numRecords > 0)
+        printf("resuming from %d checkpointed configurations\n", results.numRecords);
+
+    // one allocation serves every configuration, as amps or (twice as many) reals
+    int maxN = 0;
+    for (int i=0; i<spec->numQubitCounts; i++)
+        if (spec->qubitCounts[i] > maxN)
+            maxN = spec->qubitCounts[i];
+    amp* state = createStatevector(maxN);
+    initOnesStatevector(state, maxN);
+
+    HarnessConfig cfg = {
+        .numWarmups = spec->numWarmups, .numReps = spec->numReps,
+        .flushCache = spec->flushCache, .countEvents = HARNESS_COUNT_EVENTS};
+    int numCalls = cfg.numWarmups + cfg.numReps;
+
+    for (int q=0; q<spec->numQubitCounts; q++) {
+        int N = spec->qubitCounts[q];
+        getPhaseTable(N);
+
+        for (int th=0; th<spec->numThreadCounts; th++) {
+            int numThreads = spec->threadCounts[th];
+            setDriverThreads(numThreads);
+
+            for (int k=0; k<spec->numKernels; k++) {
+                DriverKernel* kernel = &spec->kernels[k];
+                int params[MAX_SPEC_VALUES > maxN? MAX_SPEC_VALUES : maxN];
+                int numParams = getSweepParams(spec, kernel, N, params);
+
+                for (int i=0; i<numParams; i++) {
+                    int param = params[i];
+                    if (findSweepRecord(&results, kernel->name, N, numThreads, param) != NULL)
+                        continue;
+
+                    // every m_ method tries the same random controls for this configuration
+                    int numCtrls = (kernel->param == PARAM_NUM_CTRLS)? param : 1;
+                    int ctrls[numCalls][numCtrls];
+                    if (kernel->param == PARAM_NUM_CTRLS) {
+                        srand(123456789 + 1000*N + param);
+                        for (int r=0; r<numCalls; r++)
+                            getSortedRandomSubReg(ctrls[r], numCtrls, N);
+                    }
+
+                    if (kernel->usesReals) {
+                        cfg.ampsPerRep = pow2(N) >> numCtrls;
+                        cfg.bytesPerRep = 2 * sizeof(qreal) * cfg.ampsPerRep;
+                    } else {
+                        cfg.ampsPerRep = pow2(N);
+                        cfg.bytesPerRep = 2 * sizeof(amp) * cfg.ampsPerRep;
+                    }
+
+                    SweepRecord rec;
+                    strcpy(rec.kernel, kernel->name);
+                    rec.numQubits = N;
+                    rec.numThreads = numThreads;
+                    rec.param = param;
+
+                    // the controls' reals are reset every call, the amps once per configuration
+                    if (kernel->usesReals)
+                        HARNESS_RUN(cfg, rec.stats,
+                            initArray((qreal*) state, pow2(N)),
+                            applyDriverKernel(kernel, state, param, ctrls[harnessRep], N));
+                    else {
+                        initSeededStatevector(state, N, 123456789);
+                        HARNESS_RUN(cfg, rec.stats, ,
+                            applyDriverKernel(kernel, state, param, ctrls[harnessRep], N));
+                    }
+
+                    addSweepRecord(&results, rec);
+                    appendCheckpoint(spec->checkpointFN, &rec);
+                }
+
+                printf("%s, %d qubits, %d threads\n", kernel->name, N, numThreads);
+            }
+        }
+    }
+
+    free(state);
+    writeSweepResults(spec, &results);
+    free(results.records);
+}
+
+
+
+/* launch */
+
+#ifndef EXCLUDE_MAIN
+
+int main(int argc, char* argv[]) {
+
+    if (argc != 2) {
+        printf("call as:\n\t./bench spec.txt\n");
+        return 0;
+    }
+
+    SweepSpec spec;
+    if (!loadSweepSpec(argv[1], &spec))
+        return 1;
+
+    runSweep(&spec);
+    return 0;
+}
+
+#endif // EXCLUDE_MAIN
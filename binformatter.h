@@ -0,0 +1,296 @@
+#ifndef BIN_FORMATTER_H
+#define BIN_FORMATTER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+
+/* a binary counterpart to the MMA associations of mmaformatter.h, for results
+ * too numerous to format and parse as text, and which are stored exactly
+ * rather than at outPrec digits. A file is a 16-byte header followed by one
+ * record per key, each a column of 8-byte little-endian elements (doubles, or
+ * int64 for ints), so a reader may mmap the file and use the columns in place:
+ *
+ *      header:  "QRESBIN" NUL, uint32 version, uint32 0x01020304
+ *      record:  uint32 type, uint32 numDims, uint64 keyLen,
+ *               uint64 lengths[numDims],
+ *               key, NUL-padded to a multiple of 8 bytes,
+ *               data: prod(lengths) elements (or a scalar when numDims = 0),
+ *                     or the chars of a string, NUL-padded like the key
+ *
+ * Every field is 8-byte aligned, and records are only appended, so a file can
+ * be written to a pipe. The writers mirror the writeXToAssoc functions, and
+ * convert_results.c converts a file to the equivalent MMA association.
+ */
+
+#define BIN_MAGIC "QRESBIN"
+#define BIN_VERSION 1
+#define BIN_ENDIAN_MARK 0x01020304u
+#define BIN_HEADER_BYTES 16
+#define BIN_MAX_DIMS 8
+
+typedef enum {BIN_INT, BIN_DOUBLE, BIN_STRING} BinaryType;
+
+
+
+/* writing */
+
+static inline uint64_t getLittleEndianWord(uint64_t word) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap64(word);
+#else
+    return word;
+#endif
+}
+
+void writeBinaryWords(FILE* file, const void* words, size_t numWords) {
+
+    // little-endian hosts write the column directly, others swap it in chunks
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    uint64_t chunk[512];
+    const uint64_t* in = words;
+    for (size_t i=0; i<numWords; i+=512) {
+        size_t num = (numWords - i < 512)? numWords - i : 512;
+        for (size_t j=0; j<num; j++)
+            chunk[j] = getLittleEndianWord(in[i+j]);
+        fwrite(chunk, sizeof *chunk, num, file);
+    }
+#else
+    fwrite(words, sizeof(uint64_t), numWords, file);
+#endif
+}
+
+void writeBinaryPaddedChars(FILE* file, const char* chars, size_t numChars) {
+
+    // always NUL-terminated, so that mapped keys and strings are C strings
+    char pad[8] = {0};
+    fwrite(chars, 1, numChars, file);
+    fwrite(pad, 1, 8 - (numChars % 8), file);
+}
+
+void writeBinaryRecordHeader(FILE* file, char* keyname, BinaryType type, int numDims, uint64_t* lengths) {
+
+    uint32_t head[2] = {type, numDims};
+    uint64_t keyLen = getLittleEndianWord(strlen(keyname));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    head[0] = __builtin_bswap32(head[0]);
+    head[1] = __builtin_bswap32(head[1]);
+#endif
+    fwrite(head, sizeof *head, 2, file);
+    fwrite(&keyLen, sizeof keyLen, 1, file);
+    writeBinaryWords(file, lengths, numDims);
+    writeBinaryPaddedChars(file, keyname, strlen(keyname));
+}
+
+FILE* openBinaryWrite(char* filename) {
+
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL)
+        return NULL;
+
+    uint32_t head[2] = {BIN_VERSION, BIN_ENDIAN_MARK};
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    head[0] = __builtin_bswap32(head[0]);
+    head[1] = __builtin_bswap32(head[1]);
+#endif
+    fwrite(BIN_MAGIC, 1, 8, file);
+    fwrite(head, sizeof *head, 2, file);
+    return file;
+}
+
+void closeBinaryWrite(FILE* file) {
+    fclose(file);
+}
+
+void writeIntToBinary(FILE* file, char* keyname, long long num) {
+
+    int64_t val = num;
+    writeBinaryRecordHeader(file, keyname, BIN_INT, 0, NULL);
+    writeBinaryWords(file, &val, 1);
+}
+
+void writeDoubleToBinary(FILE* file, char* keyname, double num) {
+
+    writeBinaryRecordHeader(file, keyname, BIN_DOUBLE, 0, NULL);
+    writeBinaryWords(file, &num, 1);
+}
+
+void writeStringToBinary(FILE* file, char* keyname, char* string) {
+
+    uint64_t len = strlen(string);
+    writeBinaryRecordHeader(file, keyname, BIN_STRING, 1, &len);
+    writeBinaryPaddedChars(file, string, len);
+}
+
+void writeIntArrToBinary(FILE* file, char* keyname, int* arr, int length) {
+
+    // widened to int64, so that every element is a word
+    uint64_t len = length;
+    writeBinaryRecordHeader(file, keyname, BIN_INT, 1, &len);
+    for (int i=0; i<length; i++) {
+        int64_t val = arr[i];
+        writeBinaryWords(file, &val, 1);
+    }
+}
+
+void writeDoubleArrToBinary(FILE* file, char* keyname, double* arr, long long length) {
+
+    uint64_t len = length;
+    writeBinaryRecordHeader(file, keyname, BIN_DOUBLE, 1, &len);
+    writeBinaryWords(file, arr, length);
+}
+
+void writeNestedDoubleArrToBinary(FILE* file, char* keyname, double* arr, int numDimensions, int* lengths) {
+
+    // arr is flat and row-major, with lengths outermost first
+    uint64_t lens[BIN_MAX_DIMS];
+    uint64_t numElems = 1;
+    for (int d=0; d<numDimensions; d++)
+        numElems *= (lens[d] = lengths[d]);
+    writeBinaryRecordHeader(file, keyname, BIN_DOUBLE, numDimensions, lens);
+    writeBinaryWords(file, arr, numElems);
+}
+
+
+
+/* reading */
+
+typedef struct {
+
+    char* key;
+    BinaryType type;
+    int numDims;
+    uint64_t lengths[BIN_MAX_DIMS];
+    uint64_t numElems;      // 1 for scalars, and the chars of strings
+    void* data;             // int64_t*, double* or char*, pointing into the mapping
+
+} BinaryRecord;
+
+typedef struct {
+
+    void* map;
+    size_t size;
+    int numRecords;
+    BinaryRecord* records;
+
+} BinaryResults;
+
+int loadBinaryResults(char* filename, BinaryResults* results) {
+
+    // returns 0 (having printed why) if the file is unreadable or malformed.
+    // The columns are used in place, so only little-endian hosts can read
+    results->map = NULL;
+    results->numRecords = 0;
+    results->records = NULL;
+#if defined(__linux__) && !(defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < BIN_HEADER_BYTES) {
+        printf("could not read results %s\n", filename);
+        if (fd >= 0)
+            close(fd);
+        return 0;
+    }
+    results->size = st.st_size;
+    results->map = mmap(NULL, results->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (results->map == MAP_FAILED) {
+        printf("could not map results %s\n", filename);
+        results->map = NULL;
+        return 0;
+    }
+
+    char* base = results->map;
+    uint32_t* head = (uint32_t*) (base + 8);
+    if (memcmp(base, BIN_MAGIC, 8) != 0 || head[0] != BIN_VERSION || head[1] != BIN_ENDIAN_MARK) {
+        printf("%s is not a version %d results file\n", filename, BIN_VERSION);
+        munmap(results->map, results->size);
+        results->map = NULL;
+        return 0;
+    }
+
+    // each record is validated against the end of the file before use
+    size_t pos = BIN_HEADER_BYTES;
+    int capacity = 0;
+    while (pos < results->size) {
+        if (pos + 16 > results->size)
+            break;
+        uint32_t* recHead = (uint32_t*) (base + pos);
+        uint64_t keyLen = *(uint64_t*) (base + pos + 8);
+        BinaryRecord rec = {.type = recHead[0], .numDims = recHead[1], .numElems = 1};
+        if (rec.type > BIN_STRING || rec.numDims > BIN_MAX_DIMS || keyLen > results->size)
+            break;
+        pos += 16;
+
+        if (pos + 8*rec.numDims > results->size)
+            break;
+        for (int d=0; d<rec.numDims; d++)
+            rec.numElems *= (rec.lengths[d] = ((uint64_t*) (base + pos))[d]);
+        pos += 8*rec.numDims;
+
+        rec.key = base + pos;
+        pos += keyLen + 8 - (keyLen % 8);
+
+        uint64_t dataBytes = (rec.type == BIN_STRING)?
+            rec.numElems + 8 - (rec.numElems % 8) : 8 * rec.numElems;
+        if (pos > results->size || dataBytes > results->size - pos)
+            break;
+        rec.data = base + pos;
+        pos += dataBytes;
+
+        if (results->numRecords == capacity) {
+            capacity = (capacity == 0)? 64 : 2*capacity;
+            results->records = realloc(results->records, capacity * sizeof *results->records);
+        }
+        results->records[results->numRecords++] = rec;
+    }
+
+    if (pos != results->size) {
+        printf("results %s are truncated or malformed after %d records\n", filename, results->numRecords);
+        munmap(results->map, results->size);
+        free(results->records);
+        results->map = NULL;
+        results->records = NULL;
+        results->numRecords = 0;
+        return 0;
+    }
+    return 1;
+#else
+    printf("binary results can only be read on little-endian Linux\n");
+    return 0;
+#endif
+}
+
+BinaryRecord* getBinaryRecord(BinaryResults* results, char* keyname) {
+
+    for (int r=0; r<results->numRecords; r++)
+        if (strcmp(results->records[r].key, keyname) == 0)
+            return &results->records[r];
+    return NULL;
+}
+
+void freeBinaryResults(BinaryResults* results) {
+
+#ifdef __linux__
+    if (results->map != NULL)
+        munmap(results->map, results->size);
+#endif
+    free(results->records);
+    results->map = NULL;
+    results->records = NULL;
+    results->numRecords = 0;
+}
+
+
+
+#endif // BIN_FORMATTER_H
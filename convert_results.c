@@ -0,0 +1,85 @@
+/* Converts a binary results file of binformatter.h into the equivalent MMA
+ * association of mmaformatter.h, with the same keys, so that the existing
+ * notebooks can Get it. Doubles are written with outPrec digits after the
+ * decimal point (16 by default, which preserves every double exactly). The
+ * association is streamed, so may be written to stdout (outFN -) or gzipped
+ * (an outFN ending in .gz).
+ *
+ * run with:
+ *      gcc convert_results.c -O2 -o convert
+ *      ./convert results.bin outFN [outPrec]
+ */
+
+#include "binformatter.h"
+#include "mmaformatter.h"
+
+
+
+/* conversion */
+
+void streamBinaryRecordDims(MMAStream* stream, char* keyname, BinaryRecord* rec, int dim, uint64_t offset, int precision) {
+
+    // base-case: a single element, at the flat offset
+    if (dim == rec->numDims) {
+        if (rec->type == BIN_INT)
+            writeIntToStream(stream, keyname, ((int64_t*) rec->data)[offset]);
+        else
+            writeDoubleToStream(stream, keyname, ((double*) rec->data)[offset], precision);
+        return;
+    }
+
+    // recursive case: a list of the sub-arrays, each of stride elements
+    uint64_t stride = 1;
+    for (int d=dim+1; d<rec->numDims; d++)
+        stride *= rec->lengths[d];
+
+    beginStreamList(stream, keyname);
+    for (uint64_t i=0; i<rec->lengths[dim]; i++)
+        streamBinaryRecordDims(stream, NULL, rec, dim+1, offset + i*stride, precision);
+    endStreamList(stream);
+}
+
+void streamBinaryRecord(MMAStream* stream, BinaryRecord* rec, int precision) {
+
+    if (rec->type == BIN_STRING)
+        writeStringToStream(stream, rec->key, (char*) rec->data);
+    else
+        streamBinaryRecordDims(stream, rec->key, rec, 0, 0, precision);
+}
+
+
+
+/* launch */
+
+int main(int argc, char* argv[]) {
+
+    if (argc != 3 && argc != 4) {
+        printf("call as:\n\t./convert results.bin outFN [outPrec]\n");
+        return 0;
+    }
+
+    int outPrec = (argc == 4)? atoi(argv[3]) : 16;
+    if (outPrec < 0 || outPrec > MMA_MAX_PRECISION) {
+        printf("outPrec must be between 0 and %d\n", MMA_MAX_PRECISION);
+        return 1;
+    }
+
+    BinaryResults results;
+    if (!loadBinaryResults(argv[1], &results))
+        return 1;
+
+    MMAStream* stream = (strcmp(argv[2], "-") == 0)?
+        openAssocStream(stdout) : openAssocStreamFile(argv[2]);
+    if (stream == NULL) {
+        printf("could not open %s\n", argv[2]);
+        freeBinaryResults(&results);
+        return 1;
+    }
+
+    for (int r=0; r<results.numRecords; r++)
+        streamBinaryRecord(stream, &results.records[r], outPrec);
+
+    closeAssocStream(stream);
+    freeBinaryResults(&results);
+    return 0;
+}
@@ -0,0 +1,171 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+
+/* hardware performance counters, read through Linux perf_event_open, which
+ * distinguish whether a kernel is bound by bandwidth (LLC misses per amp),
+ * by branching (branch misses), or by translation (dTLB misses). Each OpenMP
+ * thread opens its own counters, since perf cannot follow the threads of an
+ * existing pool, and the totals are summed over the threads. Only user-space
+ * events are counted, so perf_event_paranoid <= 2 suffices. Where perf is
+ * unavailable (or a particular event unsupported), the counts are -1.
+ */
+
+#define NUM_PERF_EVENTS 5
+char* perfEventNames[NUM_PERF_EVENTS] = {"cycles", "instrs", "llcMiss", "branchMiss", "tlbMiss"};
+
+#define MAX_PERF_THREADS 256
+
+typedef struct {
+
+    int numThreads;
+    int fds[MAX_PERF_THREADS][NUM_PERF_EVENTS];     // -1 where unavailable
+
+} PerfCounters;
+
+PerfCounters perfCounters = {.numThreads = 0};
+
+
+
+/* opening */
+
+#ifdef __linux__
+
+int openPerfEvent(int type, unsigned long long config, int groupFd) {
+
+    // counts the calling thread, on any CPU, disabled until enabled by its group
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = (groupFd == -1);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+void openThreadPerfEvents(int* fds) {
+
+    unsigned long long tlbMiss =
+        PERF_COUNT_HW_CACHE_DTLB |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+    // the group (led by cycles) is scheduled onto the PMU together
+    fds[0] = openPerfEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+    fds[1] = openPerfEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, fds[0]);
+    fds[2] = openPerfEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, fds[0]);
+    fds[3] = openPerfEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, fds[0]);
+    fds[4] = openPerfEvent(PERF_TYPE_HW_CACHE, tlbMiss, fds[0]);
+
+    // members cannot be grouped without a leader
+    if (fds[0] < 0)
+        for (int e=0; e<NUM_PERF_EVENTS; e++)
+            fds[e] = -1;
+}
+
+void closePerfCounters() {
+
+    for (int t=0; t<perfCounters.numThreads; t++)
+        for (int e=0; e<NUM_PERF_EVENTS; e++)
+            if (perfCounters.fds[t][e] >= 0)
+                close(perfCounters.fds[t][e]);
+    perfCounters.numThreads = 0;
+}
+
+#endif
+
+int getNumPerfThreads() {
+#ifdef _OPENMP
+    int num = omp_get_max_threads();
+    return (num < MAX_PERF_THREADS)? num : MAX_PERF_THREADS;
+#else
+    return 1;
+#endif
+}
+
+void preparePerfCounters() {
+
+    // (re)opens the counters whenever the thread pool may have changed
+#ifdef __linux__
+    int numThreads = getNumPerfThreads();
+    if (perfCounters.numThreads == numThreads)
+        return;
+
+    closePerfCounters();
+    perfCounters.numThreads = numThreads;
+
+    #pragma omp parallel num_threads(numThreads)
+    {
+#ifdef _OPENMP
+        int id = omp_get_thread_num();
+#else
+        int id = 0;
+#endif
+        openThreadPerfEvents(perfCounters.fds[id]);
+    }
+#endif
+}
+
+
+
+/* measuring */
+
+void startPerfCounters() {
+
+    // must not be called inside a parallel region
+    preparePerfCounters();
+#ifdef __linux__
+    for (int t=0; t<perfCounters.numThreads; t++) {
+        int leader = perfCounters.fds[t][0];
+        if (leader >= 0) {
+            ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+#endif
+}
+
+void stopPerfCounters(double counts[NUM_PERF_EVENTS]) {
+
+    // sums each event over the threads, or gives -1 if any thread lacks it
+    for (int e=0; e<NUM_PERF_EVENTS; e++)
+        counts[e] = (perfCounters.numThreads > 0)? 0 : -1;
+
+#ifdef __linux__
+    for (int t=0; t<perfCounters.numThreads; t++)
+        if (perfCounters.fds[t][0] >= 0)
+            ioctl(perfCounters.fds[t][0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    for (int t=0; t<perfCounters.numThreads; t++) {
+        for (int e=0; e<NUM_PERF_EVENTS; e++) {
+            unsigned long long val;
+            int fd = perfCounters.fds[t][e];
+            if (counts[e] < 0 || fd < 0 || read(fd, &val, sizeof val) != sizeof val)
+                counts[e] = -1;
+            else
+                counts[e] += val;
+        }
+    }
+#endif
+}
+
+
+
+#endif // COUNTERS_H
@@ -0,0 +1,91 @@
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include <string.h>
+
+#include "utilities.h"
+
+
+
+/* arrays resident upon an accelerator, through OpenMP target offload, so that
+ * the kernels of offload.c keep the signatures of their host counterparts but
+ * receive device pointers. A device pointer is never dereferenced by the host;
+ * it is passed into target regions by is_device_ptr, and filled or read back
+ * only by the explicit (and separately timed) transfers below. When there is
+ * no offload device (or no -fopenmp), the default device is the host itself,
+ * so the same code runs there, with the transfers as plain copies.
+ */
+
+
+
+/* devices */
+
+int getDeviceId() {
+#ifdef _OPENMP
+    return omp_get_default_device();
+#else
+    return 0;
+#endif
+}
+
+int getHostId() {
+#ifdef _OPENMP
+    return omp_get_initial_device();
+#else
+    return 0;
+#endif
+}
+
+int isDeviceOffloaded() {
+#ifdef _OPENMP
+    return omp_get_num_devices() > 0 && getDeviceId() != getHostId();
+#else
+    return 0;
+#endif
+}
+
+
+
+/* management */
+
+void* createDeviceArray(size_t numBytes) {
+
+    // NULL if the device memory is exhausted
+#ifdef _OPENMP
+    return omp_target_alloc(numBytes, getDeviceId());
+#else
+    return malloc(numBytes);
+#endif
+}
+
+void destroyDeviceArray(void* devPtr) {
+#ifdef _OPENMP
+    omp_target_free(devPtr, getDeviceId());
+#else
+    free(devPtr);
+#endif
+}
+
+
+
+/* transfers */
+
+void copyToDevice(void* devPtr, void* hostPtr, size_t numBytes) {
+#ifdef _OPENMP
+    omp_target_memcpy(devPtr, hostPtr, numBytes, 0, 0, getDeviceId(), getHostId());
+#else
+    memcpy(devPtr, hostPtr, numBytes);
+#endif
+}
+
+void copyFromDevice(void* hostPtr, void* devPtr, size_t numBytes) {
+#ifdef _OPENMP
+    omp_target_memcpy(hostPtr, devPtr, numBytes, 0, 0, getHostId(), getDeviceId());
+#else
+    memcpy(hostPtr, devPtr, numBytes);
+#endif
+}
+
+
+
+#endif // DEVICE_H
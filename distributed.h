@@ -0,0 +1,218 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <mpi.h>
+
+#include "utilities.h"
+
+
+
+/* the largest number of amplitudes sent in a single message, safely below
+ * the INT_MAX element limit of MPI counts
+ */
+#define MAX_MESSAGE_AMPS (1ULL << 28)
+
+/* the amplitudes per message of a pipelined exchange, which overlaps the
+ * communication of one chunk with the computation upon the previous, and
+ * needs only two chunks of staging buffer
+ */
+#define PIPELINE_CHUNK_AMPS (1ULL << 15)
+
+// the MPI type of an amp, at the PRECISION of utilities.h
+#if PRECISION == 1
+#define MPI_AMP MPI_C_FLOAT_COMPLEX
+#else
+#define MPI_AMP MPI_C_DOUBLE_COMPLEX
+#endif
+
+
+
+/* partitioned state-vector management */
+
+/* a statevector of 2^numQubits amplitudes, distributed between numRanks = 2^R
+ * ranks. Each rank stores the 2^numLocalQubits contiguous amplitudes whose
+ * upper R index bits equal its rank, so that qubits at or above numLocalQubits
+ * are "rank qubits", determined entirely by the rank index.
+ */
+typedef struct {
+
+    amp* amps;
+    amp* buffer;    // receives the partner partition during exchanges
+    INDEX numBufferAmps;    // numLocalAmps, or only two pipeline chunks if lean
+
+    int numQubits;
+    int numLocalQubits;
+    INDEX numLocalAmps;
+
+    int rank;
+    int numRanks;
+    MPI_Comm comm;
+
+} DistribStatevector;
+
+/* returns R, where the numRanks = 2^R ranks of comm partition 2^numQubits
+ * elements, aborting every rank if numRanks is not a power of 2, or exceeds
+ * the number of elements
+ */
+int getNumRankQubitsOrAbort(int numQubits, MPI_Comm comm) {
+
+    int rank, numRanks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &numRanks);
+
+    int numRankQubits = 0;
+    while (pow2(numRankQubits) < (INDEX) numRanks)
+        numRankQubits++;
+    if (pow2(numRankQubits) != (INDEX) numRanks || numRankQubits > numQubits) {
+        if (rank == 0)
+            printf("cannot distribute %d qubits between %d ranks\n", numQubits, numRanks);
+        MPI_Abort(comm, 1);
+    }
+    return numRankQubits;
+}
+
+/* a lean statevector allocates only the staging buffer of the pipelined
+ * exchanges, so its peak memory is ~1x (rather than 2x) the partition. It
+ * supports every gate but those exchanging or permuting whole partitions (the
+ * swaps and bit reversal upon rank qubits), which require the full buffer.
+ */
+
+DistribStatevector createDistribStatevectorOfBuffer(int numQubits, MPI_Comm comm, int isLean) {
+
+    DistribStatevector vec;
+    vec.numQubits = numQubits;
+    vec.comm = comm;
+    MPI_Comm_rank(comm, &vec.rank);
+    MPI_Comm_size(comm, &vec.numRanks);
+
+    int numRankQubits = getNumRankQubitsOrAbort(numQubits, comm);
+    vec.numLocalQubits = numQubits - numRankQubits;
+    vec.numLocalAmps = pow2(vec.numLocalQubits);
+    vec.amps = createStatevector(vec.numLocalQubits);
+    vec.numBufferAmps = vec.numLocalAmps;
+    if (isLean && 2*PIPELINE_CHUNK_AMPS < vec.numLocalAmps)
+        vec.numBufferAmps = 2*PIPELINE_CHUNK_AMPS;
+    vec.buffer = malloc(vec.numBufferAmps * sizeof *vec.buffer);
+    return vec;
+}
+
+DistribStatevector createDistribStatevector(int numQubits, MPI_Comm comm) {
+    return createDistribStatevectorOfBuffer(numQubits, comm, 0);
+}
+
+DistribStatevector createLeanDistribStatevector(int numQubits, MPI_Comm comm) {
+    return createDistribStatevectorOfBuffer(numQubits, comm, 1);
+}
+
+void requireFullBuffer(DistribStatevector* vec) {
+
+    // called by the gates which exchange whole partitions
+    if (vec->numBufferAmps < vec->numLocalAmps) {
+        if (vec->rank == 0)
+            printf("this gate requires a statevector created by createDistribStatevector\n");
+        MPI_Abort(vec->comm, 1);
+    }
+}
+
+void destroyDistribStatevector(DistribStatevector* vec) {
+
+    free(vec->amps);
+    free(vec->buffer);
+}
+
+void initRandomDistribStatevector(DistribStatevector* vec) {
+
+    // callers should seed each rank differently, else every partition is identical
+    double mag = 0;
+    for (INDEX i=0; i<vec->numLocalAmps; i++) {
+        vec->amps[i] = getRandomComplex(-1-I, 1+I);
+        mag += getAbsSquared(vec->amps[i]);
+    }
+
+    MPI_Allreduce(MPI_IN_PLACE, &mag, 1, MPI_DOUBLE, MPI_SUM, vec->comm);
+
+    mag = sqrt(mag);
+    for (INDEX i=0; i<vec->numLocalAmps; i++)
+        vec->amps[i] /= mag;
+}
+
+void initSeededDistribStatevector(DistribStatevector* vec, uint64_t seed) {
+
+    // identical to initSeededStatevector upon the full state, for any number of ranks
+    INDEX firstIndex = (INDEX) vec->rank << vec->numLocalQubits;
+    double localNorm = setSeededAmps(vec->amps, vec->numLocalAmps, firstIndex, seed);
+
+    // each rank's norm fills only its own slot, so the sum is exact in any order
+    double rankNorms[vec->numRanks];
+    for (int r=0; r<vec->numRanks; r++)
+        rankNorms[r] = 0;
+    rankNorms[vec->rank] = localNorm;
+    MPI_Allreduce(MPI_IN_PLACE, rankNorms, vec->numRanks, MPI_DOUBLE, MPI_SUM, vec->comm);
+
+    double norm = getPairwiseSum(rankNorms, vec->numRanks);
+    scaleStatevector(vec->amps, vec->numLocalAmps, 1/sqrt(norm));
+}
+
+
+
+/* rank qubits */
+
+FORCE_INLINE int isRankQubit(DistribStatevector* vec, int q) {
+    return q >= vec->numLocalQubits;
+}
+
+FORCE_INLINE int getRankBit(DistribStatevector* vec, int q) {
+    return getBit(vec->rank, q - vec->numLocalQubits);
+}
+
+FORCE_INLINE int getPairRank(DistribStatevector* vec, int q) {
+    return flipBit(vec->rank, q - vec->numLocalQubits);
+}
+
+FORCE_INLINE INDEX getGlobalIndex(DistribStatevector* vec, INDEX localInd) {
+    return ((INDEX) vec->rank << vec->numLocalQubits) | localInd;
+}
+
+
+
+/* communication timing */
+
+/* the time each rank spends within MPI calls which move amplitudes (comm), and
+ * blocked upon outstanding messages (wait), accumulated by every exchange, so
+ * that benchmarks may split a kernel's duration into compute, comm and wait
+ */
+typedef struct {
+
+    double comm;
+    double wait;
+
+} CommTimes;
+
+CommTimes commTimes = {0, 0};
+
+#define TIME_MPI(FIELD, CALL) \
+    do { \
+        double mpiStart = MPI_Wtime(); \
+        CALL; \
+        commTimes.FIELD += MPI_Wtime() - mpiStart; \
+    } while (0)
+
+
+
+/* communication */
+
+void exchangeAmps(DistribStatevector* vec, amp* send, amp* recv, INDEX numAmps, int pairRank) {
+
+    // swap numAmps between this rank and pairRank, in messages of bounded size
+    for (INDEX i=0; i<numAmps; i+=MAX_MESSAGE_AMPS) {
+        INDEX num = (numAmps - i < MAX_MESSAGE_AMPS)? numAmps - i : MAX_MESSAGE_AMPS;
+        TIME_MPI(comm, MPI_Sendrecv(
+            &send[i], (int) num, MPI_AMP, pairRank, 0,
+            &recv[i], (int) num, MPI_AMP, pairRank, 0,
+            vec->comm, MPI_STATUS_IGNORE));
+    }
+}
+
+
+
+#endif // DISTRIBUTED_H
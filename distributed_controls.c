@@ -0,0 +1,251 @@
+/* Distributed counterparts of the local control-qubit methods C and D of
+ * local_controls.c, where the array of 2^numQubits amplitudes is partitioned
+ * contiguously between 2^R MPI ranks. A control qubit at or above the local
+ * qubits (numLocalQubits) is fixed throughout a rank's partition, so is
+ * evaluated once per rank; a rank failing such a control returns immediately,
+ * while a rank satisfying it drops it from the controls passed to the local
+ * method. This handles the edge cases where none or all local amplitudes pass.
+ *
+ * It is important that inline functions are actually inlined, so pass optimisation
+ * flags (especially with Clang)
+ * run with:
+ *      mpicc distributed_controls.c -O3 -lm -fopenmp -o test
+ *      mpirun -np 4 ./test [s/m] numQubits numReps outFN
+ */
+
+#ifdef EXCLUDE_MAIN
+#include "local_controls.c"
+#else
+#define EXCLUDE_MAIN
+#include "local_controls.c"
+#undef EXCLUDE_MAIN
+#endif
+
+#include <mpi.h>
+
+#include "distributed.h"
+
+
+
+/* partition */
+
+FORCE_INLINE int getNumLocalQubits(INDEX numLocalAmps) {
+    return __builtin_ctzll(numLocalAmps);
+}
+
+
+
+/* single control methods */
+
+void s_distribMethodC(qreal* amps, INDEX numLocalAmps, int c, int rank) {
+    int L = getNumLocalQubits(numLocalAmps);
+    if (c < L)
+        s_methodC(amps, numLocalAmps, c);
+    else if (getBit(rank, c-L))
+        applyUncontrolled(amps, numLocalAmps);
+}
+
+void s_distribMethodD(qreal* amps, INDEX numLocalAmps, int c, int rank) {
+    int L = getNumLocalQubits(numLocalAmps);
+    if (c < L)
+        s_methodD(amps, numLocalAmps, c);
+    else if (getBit(rank, c-L))
+        applyUncontrolled(amps, numLocalAmps);
+}
+
+void (*s_distribMethods[2]) (qreal* amps, INDEX numLocalAmps, int c, int rank) = {
+    s_distribMethodC, s_distribMethodD
+};
+char* s_distribMethodNames[2] = {"C", "D"};
+
+
+
+/* many control methods */
+
+void m_distribMethodD(qreal* amps, INDEX numLocalAmps, int* ctrls, int numCtrls, int rank) {
+    int L = getNumLocalQubits(numLocalAmps);
+
+    // evaluate the rank controls once, keeping only the (increasing) local controls
+    int localCtrls[numCtrls];
+    int numLocalCtrls = 0;
+    for (int c=0; c<numCtrls; c++) {
+        if (ctrls[c] < L)
+            localCtrls[numLocalCtrls++] = ctrls[c];
+        else if (!getBit(rank, ctrls[c]-L))
+            return;
+    }
+
+    if (numLocalCtrls == 0)
+        applyUncontrolled(amps, numLocalAmps);
+    else
+        m_methodD(amps, numLocalAmps, localCtrls, numLocalCtrls);
+}
+
+void (*m_distribMethods[1]) (qreal* amps, INDEX numLocalAmps, int* ctrls, int numCtrls, int rank) = {
+    m_distribMethodD
+};
+char* m_distribMethodNames[1] = {"D"};
+
+
+
+/* launch */
+
+#ifndef EXCLUDE_MAIN
+
+double getMaxDuration(double dur) {
+
+    // the slowest rank determines the duration
+    MPI_Allreduce(MPI_IN_PLACE, &dur, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    return dur;
+}
+
+void s_distribBenchmarking(int numQubits, int numReps, char* outFN) {
+
+    int rank, numRanks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &numRanks);
+
+    int outPrec = 5;
+    INDEX numLocalAmps = pow2(numQubits - getNumRankQubitsOrAbort(numQubits, MPI_COMM_WORLD));
+    qreal* amps = malloc(numLocalAmps * sizeof *amps);
+    if (rank == 0)
+        printf("[%d qubits, %d ranks]\n\n", numQubits, numRanks);
+
+    initArray(amps, numLocalAmps);
+
+    double durs[2][numQubits];
+    double vars[2][numQubits];
+
+    for (int m=0; m<2; m++) {
+        for (int c=0; c<numQubits; c++) {
+
+            double rawDurs[numReps];
+
+            for (int r=0; r<numReps; r++) {
+                initArray(amps, numLocalAmps);
+
+                MPI_Barrier(MPI_COMM_WORLD);
+                START_TIMING()
+                s_distribMethods[m](amps, numLocalAmps, c, rank);
+                RECORD_TIMING(double dur);
+
+                rawDurs[r] = getMaxDuration(dur);
+            }
+
+            getAverageAndVariance(rawDurs, numReps, &durs[m][c], &vars[m][c]);
+        }
+    }
+
+    if (rank == 0) {
+        FILE* file = openAssocWrite(outFN);
+        writeStringToAssoc(file, "precision", PRECISION_NAME);
+        writeStringToAssoc(file, "note", "timings are already per-rep, and the maximum over ranks");
+        writeIntToAssoc(file, "numQubits", numQubits);
+        writeIntToAssoc(file, "numRanks", numRanks);
+        writeIntToAssoc(file, "numReps", numReps);
+        writeIntToAssoc(file, "outPrec", outPrec);
+        for (int m=0; m<2; m++) {
+            char buff[50];
+            strcpy(buff, "dur_"); strcat(buff, s_distribMethodNames[m]);
+            writeDoubleArrToAssoc(file, buff, durs[m], numQubits, outPrec);
+            strcpy(buff, "var_"); strcat(buff, s_distribMethodNames[m]);
+            writeDoubleArrToAssoc(file, buff, vars[m], numQubits, outPrec);
+        }
+        closeAssocWrite(file);
+    }
+
+    free(amps);
+}
+
+void m_distribBenchmarking(int numQubits, int numReps, char* outFN) {
+
+    int rank, numRanks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &numRanks);
+
+    int outPrec = 10;
+    INDEX numLocalAmps = pow2(numQubits - getNumRankQubitsOrAbort(numQubits, MPI_COMM_WORLD));
+    qreal* amps = malloc(numLocalAmps * sizeof *amps);
+    if (rank == 0)
+        printf("[%d qubits, %d ranks]\n\n", numQubits, numRanks);
+
+    initArray(amps, numLocalAmps);
+
+    double durs[1][numQubits+1];
+    double vars[1][numQubits+1];
+    for (int i=0; i<(numQubits+1); i++) {
+        durs[0][i] = -1;
+        vars[0][i] = -1;
+    }
+
+    for (int numCtrls=2; numCtrls<=numQubits; numCtrls++) {
+        int ctrls[numCtrls];
+        double rawDurs[numReps];
+
+        for (int r=0; r<numReps; r++) {
+
+            // every rank must try the same controls
+            if (rank == 0)
+                getSortedRandomSubReg(ctrls, numCtrls, numQubits);
+            MPI_Bcast(ctrls, numCtrls, MPI_INT, 0, MPI_COMM_WORLD);
+
+            initArray(amps, numLocalAmps);
+
+            MPI_Barrier(MPI_COMM_WORLD);
+            START_TIMING();
+            m_distribMethodD(amps, numLocalAmps, ctrls, numCtrls, rank);
+            RECORD_TIMING(double dur);
+
+            rawDurs[r] = getMaxDuration(dur);
+        }
+
+        getAverageAndVariance(rawDurs, numReps, &durs[0][numCtrls], &vars[0][numCtrls]);
+    }
+
+    if (rank == 0) {
+        FILE* file = openAssocWrite(outFN);
+        writeStringToAssoc(file, "precision", PRECISION_NAME);
+        writeStringToAssoc(file, "note", "timings are already per-rep, and the maximum over ranks");
+        writeIntToAssoc(file, "numQubits", numQubits);
+        writeIntToAssoc(file, "numRanks", numRanks);
+        writeIntToAssoc(file, "numReps", numReps);
+        writeIntToAssoc(file, "outPrec", outPrec);
+        char buff[50];
+        strcpy(buff, "dur_"); strcat(buff, m_distribMethodNames[0]);
+        writeDoubleArrToAssoc(file, buff, durs[0], numQubits+1, outPrec);
+        strcpy(buff, "var_"); strcat(buff, m_distribMethodNames[0]);
+        writeDoubleArrToAssoc(file, buff, vars[0], numQubits+1, outPrec);
+        closeAssocWrite(file);
+    }
+
+    free(amps);
+}
+
+int main(int argc, char* argv[]) {
+
+    MPI_Init(&argc, &argv);
+
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    srand(123456789);
+
+    if (argc == 5 && argv[1][0] == 's') {
+        int numQubits = atoi(argv[2]);
+        int numReps = atoi(argv[3]);
+        char* outFN = argv[4];
+        s_distribBenchmarking(numQubits, numReps, outFN);
+
+    } else if (argc == 5 && argv[1][0] == 'm') {
+        int numQubits = atoi(argv[2]);
+        int numReps = atoi(argv[3]);
+        char* outFN = argv[4];
+        m_distribBenchmarking(numQubits, numReps, outFN);
+
+    } else if (rank == 0)
+        printf("call as:\n\tmpirun -np 2^R ./exec [s/m] numQubits numReps outFN\n");
+
+    MPI_Finalize();
+    return 0;
+}
+
+#endif // EXCLUDE_MAIN
@@ -0,0 +1,555 @@
+/* Distributed simulation of the QFT, comparing direct evaluation of the
+ * circuit against the merged-phase algorithm, when the statevector is
+ * partitioned between 2^R MPI ranks. Gates upon local qubits reuse the local
+ * kernels of local_qft.c on each partition, while Hadamards and swaps upon
+ * rank qubits exchange amplitudes pairwise with a single partner rank. Diagonal
+ * gates (including the merged phases) never communicate, since they depend only
+ * upon the global amplitude index. The exchange of a Hadamard is pipelined,
+ * overlapping the communication of each chunk with the butterfly upon the
+ * previous, through a bounded staging buffer; a lean statevector allocates
+ * only that buffer, so the relabelled QFT needs ~1x (not 2x) the memory.
+ *
+ * It is important that inline functions are actually inlined, so pass optimisation
+ * flags (especially with Clang)
+ * run with:
+ *      mpicc distributed_qft.c -O3 -lm -fopenmp -o test
+ *      mpirun -np 4 ./test 26
+ */
+
+#ifdef EXCLUDE_MAIN
+#include "local_qft.c"
+#else
+#define EXCLUDE_MAIN
+#include "local_qft.c"
+#undef EXCLUDE_MAIN
+#endif
+
+#include "distributed.h"
+
+
+
+/* local helpers */
+
+void applyLocalPhaseShift(amp* psi, int t, double theta, int N) {
+
+    const amp fac = expI(theta);
+
+    // |j>|1>|k>
+    const INDEX jNum = pow2(N-(t+1));
+    const INDEX kNum = pow2(t);
+
+    for (INDEX j=0; j<jNum; j++) {
+        for (INDEX k=0; k<kNum; k++) {
+
+            INDEX j1k = flipBit(getZeroBitFromAffix(j, k, t), t);
+            psi[j1k] *= fac;
+        }
+    }
+}
+
+void swapPartitions(DistribStatevector* vec) {
+
+    amp* tmp = vec->amps;
+    vec->amps = vec->buffer;
+    vec->buffer = tmp;
+}
+
+
+
+/* gates */
+
+void applyDistribHadamardBlocking(DistribStatevector* vec, int t) {
+
+    if (!isRankQubit(vec, t)) {
+        applyHadamard(vec->amps, t, vec->numLocalQubits);
+        return;
+    }
+
+    // obtain the partner partition which differs only in bit t
+    requireFullBuffer(vec);
+    exchangeAmps(vec, vec->amps, vec->buffer, vec->numLocalAmps, getPairRank(vec, t));
+
+    const qreal fac = 1/sqrt(2);
+    amp* psi = vec->amps;
+    amp* pair = vec->buffer;
+
+    // |0> ranks keep a1+a2, while |1> ranks keep a1-a2
+    if (getRankBit(vec, t) == 0)
+        for (INDEX i=0; i<vec->numLocalAmps; i++)
+            psi[i] = fac*psi[i] + fac*pair[i];
+    else
+        for (INDEX i=0; i<vec->numLocalAmps; i++)
+            psi[i] = fac*pair[i] - fac*psi[i];
+}
+
+void postHadamardChunk(DistribStatevector* vec, amp* stage, INDEX first, INDEX num, int pairRank, MPI_Request* reqs) {
+
+    TIME_MPI(comm, MPI_Irecv(stage, (int) num, MPI_AMP, pairRank, 0, vec->comm, &reqs[0]));
+    TIME_MPI(comm, MPI_Isend(&vec->amps[first], (int) num, MPI_AMP, pairRank, 0, vec->comm, &reqs[1]));
+}
+
+void applyDistribHadamard(DistribStatevector* vec, int t) {
+
+    if (!isRankQubit(vec, t)) {
+        applyHadamard(vec->amps, t, vec->numLocalQubits);
+        return;
+    }
+
+    /* the partition is exchanged in chunks, the next of which is posted before
+     * the butterfly upon the current. A chunk is sent directly from the amps, 
+     * and overwritten only once its send completes, so the partner's chunks
+     * need only two staging buffers, used alternately. A partition of a single
+     * amplitude cannot be halved into two stages, so is exchanged whole
+     */
+    if (vec->numBufferAmps < 2) {
+        applyDistribHadamardBlocking(vec, t);
+        return;
+    }
+
+    INDEX chunkAmps = vec->numBufferAmps / 2;
+    if (chunkAmps > PIPELINE_CHUNK_AMPS)
+        chunkAmps = PIPELINE_CHUNK_AMPS;
+    INDEX numChunks = vec->numLocalAmps / chunkAmps;
+
+    int pairRank = getPairRank(vec, t);
+    int rankBit = getRankBit(vec, t);
+    const qreal fac = 1/sqrt(2);
+
+    amp* stages[2] = {vec->buffer, &vec->buffer[chunkAmps]};
+    MPI_Request reqs[2][2];
+    postHadamardChunk(vec, stages[0], 0, chunkAmps, pairRank, reqs[0]);
+
+    for (INDEX n=0; n<numChunks; n++) {
+        if (n+1 < numChunks)
+            postHadamardChunk(vec, stages[(n+1)%2], (n+1)*chunkAmps, chunkAmps, pairRank, reqs[(n+1)%2]);
+        TIME_MPI(wait, MPI_Waitall(2, reqs[n%2], MPI_STATUSES_IGNORE));
+
+        // |0> ranks keep a1+a2, while |1> ranks keep a1-a2
+        amp* psi = &vec->amps[n*chunkAmps];
+        amp* pair = stages[n%2];
+        INDEX i;
+        if (rankBit == 0) {
+            #pragma omp parallel for shared(psi,pair,chunkAmps) private(i) schedule(static)
+            for (i=0; i<chunkAmps; i++)
+                psi[i] = fac*psi[i] + fac*pair[i];
+        } else {
+            #pragma omp parallel for shared(psi,pair,chunkAmps) private(i) schedule(static)
+            for (i=0; i<chunkAmps; i++)
+                psi[i] = fac*pair[i] - fac*psi[i];
+        }
+    }
+}
+
+void applyDistribControlledPhase(DistribStatevector* vec, int c, int t, double theta) {
+
+    int cLocal = !isRankQubit(vec, c);
+    int tLocal = !isRankQubit(vec, t);
+
+    if (cLocal && tLocal) {
+        applyControlledPhase(vec->amps, c, t, theta, vec->numLocalQubits);
+        return;
+    }
+
+    // both rank qubits determine whether every or no local amp is shifted
+    if (!cLocal && !tLocal) {
+        if (getRankBit(vec, c) && getRankBit(vec, t)) {
+            const amp fac = expI(theta);
+            for (INDEX i=0; i<vec->numLocalAmps; i++)
+                vec->amps[i] *= fac;
+        }
+        return;
+    }
+
+    // otherwise the rank qubit conditions a phase upon the local qubit
+    int r = cLocal? t : c;
+    int l = cLocal? c : t;
+    if (getRankBit(vec, r))
+        applyLocalPhaseShift(vec->amps, l, theta, vec->numLocalQubits);
+}
+
+void applyDistribSwap(DistribStatevector* vec, int t1, int t2) {
+    if (t1 > t2) {
+        int t = t1;
+        t1 = t2;
+        t2 = t;
+    }
+
+    const int L = vec->numLocalQubits;
+
+    if (!isRankQubit(vec, t2)) {
+        applySwap(vec->amps, t1, t2, L);
+        return;
+    }
+
+    // two rank qubits swap entire partitions, only between ranks where they differ
+    requireFullBuffer(vec);
+    if (isRankQubit(vec, t1)) {
+        if (getRankBit(vec, t1) != getRankBit(vec, t2)) {
+            int pairRank = flipBit(flipBit(vec->rank, t1-L), t2-L);
+            exchangeAmps(vec, vec->amps, vec->buffer, vec->numLocalAmps, pairRank);
+            swapPartitions(vec);
+        }
+        return;
+    }
+
+    // local amps |j>|b'>|k> (where b' != rank bit b of t2) swap with |j>|b>|k> of the
+    // partner rank, so pack the half, exchange it, and unpack it in the same order
+    const INDEX jNum = pow2(L-(t1+1));
+    const INDEX kNum = pow2(t1);
+    const INDEX half = vec->numLocalAmps / 2;
+    const int b = getRankBit(vec, t2);
+
+    amp* send = vec->buffer;
+    amp* recv = &vec->buffer[half];
+
+    for (INDEX j=0; j<jNum; j++)
+        for (INDEX k=0; k<kNum; k++)
+            send[j*kNum + k] = vec->amps[getZeroBitFromAffix(j, k, t1) | ((INDEX) !b << t1)];
+
+    exchangeAmps(vec, send, recv, half, getPairRank(vec, t2));
+
+    for (INDEX j=0; j<jNum; j++)
+        for (INDEX k=0; k<kNum; k++)
+            vec->amps[getZeroBitFromAffix(j, k, t1) | ((INDEX) !b << t1)] = recv[j*kNum + k];
+}
+
+
+
+/* QFT by circuit */
+
+void applyDistribMultiplePhases(DistribStatevector* vec, int tMax) {
+
+    int m = 2;
+    for (int t=tMax-1; t>=0; t--) {
+        double theta = 2 * M_PI / (double) pow2(m);
+        applyDistribControlledPhase(vec, tMax, t, theta);
+        m++;
+    }
+}
+
+void applyDistribQFTCircuit(DistribStatevector* vec) {
+
+    const int N = vec->numQubits;
+
+    for (int t=N-1; t>0; t--) {
+        applyDistribHadamard(vec, t);
+        applyDistribMultiplePhases(vec, t);
+    }
+    applyDistribHadamard(vec, 0);
+
+    for (int t=0; t<N/2; t++)
+        applyDistribSwap(vec, t, N-t-1);
+}
+
+
+
+/* QFT by algorithm */
+
+void applyDistribMergedPhases(DistribStatevector* vec, int tMax) {
+
+    // a local tMax makes the whole diagonal depend only on local index bits
+    if (!isRankQubit(vec, tMax)) {
+        applyMergedPhases(vec->amps, tMax, vec->numLocalQubits);
+        return;
+    }
+
+    // otherwise every local amp shares bit tMax, so ranks in |0> skip all work
+    if (getRankBit(vec, tMax) == 0)
+        return;
+
+    // and the |1> ranks phase every amp by its global index (below tMax)
+    PhaseTable* table = getPhaseTable(vec->numQubits);
+    const INDEX kMask = pow2(tMax)-1;
+    const INDEX offset = getGlobalIndex(vec, 0) & kMask;
+    const INDEX numAmps = vec->numLocalAmps;
+    amp* psi = vec->amps;
+    INDEX i;
+
+    #pragma omp parallel for shared(psi,table,numAmps) private(i) schedule(static)
+    for (i=0; i<numAmps; i++)
+        psi[i] *= getPhaseFactor(table, offset + i, tMax);
+}
+
+void applyDistribQFTAlgorithm(DistribStatevector* vec) {
+
+    const int N = vec->numQubits;
+
+    for (int t=N-1; t>0; t--) {
+        applyDistribHadamard(vec, t);
+        applyDistribMergedPhases(vec, t);
+    }
+    applyDistribHadamard(vec, 0);
+
+    for (int t=0; t<N/2; t++)
+        applyDistribSwap(vec, t, N-t-1);
+}
+
+
+
+/* bit reversal */
+
+/* Reverses all N qubits with a single all-to-all exchange. Amplitude |r>|l> of
+ * rank r maps to |rev l>|rev r>, so that its destination rank is set by the lowest
+ * R bits of l. Each rank thus sends 2^(L-R) amps to every rank, packed in order
+ * of increasing l, which the receiver then scatters into their reversed local
+ * indices. This requires at least as many local qubits (L) as rank qubits (R).
+ */
+
+void applyDistribBitReversal(DistribStatevector* vec) {
+    
+    const int N = vec->numQubits;
+    const int L = vec->numLocalQubits;
+    const int R = N - L;
+    
+    if (R == 0) {
+        applyBitReversal(vec->amps, N);
+        return;
+    }
+    
+    // each rank's packet is a contiguous block of cNum amps, built from blocks
+    // of at most MAX_MESSAGE_AMPS (both powers of 2) so no count exceeds INT_MAX
+    requireFullBuffer(vec);
+    const INDEX cNum = vec->numLocalAmps >> R;
+    MPI_Datatype packet;
+    if (cNum <= MAX_MESSAGE_AMPS)
+        MPI_Type_contiguous((int) cNum, MPI_AMP, &packet);
+    else {
+        MPI_Datatype block;
+        MPI_Type_contiguous((int) MAX_MESSAGE_AMPS, MPI_AMP, &block);
+        MPI_Type_contiguous((int) (cNum / MAX_MESSAGE_AMPS), block, &packet);
+        MPI_Type_free(&block);
+    }
+    MPI_Type_commit(&packet);
+    
+    int counts[vec->numRanks];
+    int displs[vec->numRanks];
+    for (int r=0; r<vec->numRanks; r++) {
+        counts[r] = 1;
+        displs[r] = r;
+    }
+    
+    // pack |k>|x> into the packet of rank rev x, at position k
+    for (INDEX l=0; l<vec->numLocalAmps; l++) {
+        INDEX dest = reverseBits(truncateBits(l, R), R);
+        vec->buffer[dest*cNum + (l >> R)] = vec->amps[l];
+    }
+    
+    TIME_MPI(comm, MPI_Alltoallv(
+        vec->buffer, counts, displs, packet, 
+        vec->amps,   counts, displs, packet, vec->comm));
+    
+    // the k-th amp from rank s originated at global |s>|k>|rev rank>
+    const INDEX x = reverseBits(vec->rank, R);
+    for (INDEX s=0; s<(INDEX) vec->numRanks; s++)
+        for (INDEX k=0; k<cNum; k++) {
+            INDEX g = (s << L) | (k << R) | x;
+            vec->buffer[truncateBits(reverseBits(g, N), L)] = vec->amps[s*cNum + k];
+        }
+    swapPartitions(vec);
+    
+    MPI_Type_free(&packet);
+}
+
+
+
+/* QFT with permuted output */
+
+/* every swap upon a rank qubit is an exchange, so the trailing swaps are instead
+ * recorded in qubitMap (as in local_qft.c) and only realised upon request
+ */
+
+void realiseDistribQubitMap(DistribStatevector* vec, int* qubitMap) {
+    
+    const int N = vec->numQubits;
+    const int L = vec->numLocalQubits;
+    
+    if (N > 1 && L >= N - L && isReversedQubitMap(qubitMap, N)) {
+        applyDistribBitReversal(vec);
+        initQubitMap(qubitMap, N);
+        return;
+    }
+    
+    for (int q=0; q<vec->numQubits; q++) {
+        int p = qubitMap[q];
+        if (p == q)
+            continue;
+        
+        int r = q;
+        while (qubitMap[r] != q)
+            r++;
+        
+        applyDistribSwap(vec, q, p);
+        qubitMap[r] = p;
+        qubitMap[q] = q;
+    }
+}
+
+void applyDistribQFTAlgorithmPermuted(DistribStatevector* vec, int* qubitMap) {
+    
+    const int N = vec->numQubits;
+    
+    if (!isIdentityQubitMap(qubitMap, N))
+        realiseDistribQubitMap(vec, qubitMap);
+
+    for (int t=N-1; t>0; t--) {
+        applyDistribHadamard(vec, t);
+        applyDistribMergedPhases(vec, t);
+    }
+    applyDistribHadamard(vec, 0);
+    
+    for (int t=0; t<N/2; t++)
+        applyMappedSwap(qubitMap, t, N-t-1);
+}
+
+
+
+/* QFT by algorithm, with bit reversal */
+
+void applyDistribQFTAlgorithmBitReversal(DistribStatevector* vec) {
+    
+    const int N = vec->numQubits;
+    
+    for (int t=N-1; t>0; t--) {
+        applyDistribHadamard(vec, t);
+        applyDistribMergedPhases(vec, t);
+    }
+    applyDistribHadamard(vec, 0);
+    
+    // the swap network remains the only option with too few local qubits
+    if (vec->numLocalQubits >= N - vec->numLocalQubits)
+        applyDistribBitReversal(vec);
+    else
+        for (int t=0; t<N/2; t++)
+            applyDistribSwap(vec, t, N-t-1);
+}
+
+
+
+/* launch */
+
+#ifndef EXCLUDE_MAIN
+
+int main(int argc, char* argv[]) {
+
+    MPI_Init(&argc, &argv);
+
+    int N = (argc > 1)? atoi(argv[1]) : 24;
+    DistribStatevector vec = createDistribStatevector(N, MPI_COMM_WORLD);
+    initSeededDistribStatevector(&vec, 123456789);
+
+    if (vec.rank == 0)
+        printf("[%d qubits, %d ranks, %d local qubits]\n\n", N, vec.numRanks, vec.numLocalQubits);
+
+    double durPhases, durMerged, durCirc, durAlg, durPerm, durReal, durRev;
+    double durBlock, durPipe, durLean;
+    {
+        MPI_Barrier(vec.comm);
+        START_TIMING()
+        for (int t=vec.numLocalQubits; t<N; t++)
+            applyDistribHadamardBlocking(&vec, t);
+        MPI_Barrier(vec.comm);
+        RECORD_TIMING(durBlock)
+    }
+    {
+        MPI_Barrier(vec.comm);
+        START_TIMING()
+        for (int t=vec.numLocalQubits; t<N; t++)
+            applyDistribHadamard(&vec, t);
+        MPI_Barrier(vec.comm);
+        RECORD_TIMING(durPipe)
+    }
+    {
+        MPI_Barrier(vec.comm);
+        START_TIMING()
+        applyDistribMultiplePhases(&vec, N-1);
+        MPI_Barrier(vec.comm);
+        RECORD_TIMING(durPhases)
+    }
+    {
+        MPI_Barrier(vec.comm);
+        START_TIMING()
+        applyDistribMergedPhases(&vec, N-1);
+        MPI_Barrier(vec.comm);
+        RECORD_TIMING(durMerged)
+    }
+    {
+        MPI_Barrier(vec.comm);
+        START_TIMING()
+        applyDistribQFTCircuit(&vec);
+        MPI_Barrier(vec.comm);
+        RECORD_TIMING(durCirc)
+    }
+    {
+        MPI_Barrier(vec.comm);
+        START_TIMING()
+        applyDistribQFTAlgorithm(&vec);
+        MPI_Barrier(vec.comm);
+        RECORD_TIMING(durAlg)
+    }
+
+    {
+        MPI_Barrier(vec.comm);
+        START_TIMING()
+        applyDistribQFTAlgorithmBitReversal(&vec);
+        MPI_Barrier(vec.comm);
+        RECORD_TIMING(durRev)
+    }
+    {
+        int qubitMap[N];
+        initQubitMap(qubitMap, N);
+        {
+            MPI_Barrier(vec.comm);
+            START_TIMING()
+            applyDistribQFTAlgorithmPermuted(&vec, qubitMap);
+            MPI_Barrier(vec.comm);
+            RECORD_TIMING(durPerm)
+        }
+        {
+            MPI_Barrier(vec.comm);
+            START_TIMING()
+            realiseDistribQubitMap(&vec, qubitMap);
+            MPI_Barrier(vec.comm);
+            RECORD_TIMING(durReal)
+        }
+    }
+
+    // the relabelled QFT exchanges only within Hadamards, so runs upon a lean 
+    // statevector, which is created only once the full one is freed
+    destroyDistribStatevector(&vec);
+    vec = createLeanDistribStatevector(N, MPI_COMM_WORLD);
+    initSeededDistribStatevector(&vec, 123456789);
+    {
+        int qubitMap[N];
+        initQubitMap(qubitMap, N);
+        MPI_Barrier(vec.comm);
+        START_TIMING()
+        applyDistribQFTAlgorithmPermuted(&vec, qubitMap);
+        MPI_Barrier(vec.comm);
+        RECORD_TIMING(durLean)
+    }
+
+    if (vec.rank == 0) {
+        printf("Hadamards upon every rank qubit\n");
+        printf("\tblocking exchange\n\t\t%f (s)\n", durBlock);
+        printf("\tpipelined exchange\n\t\t%f (s)\n", durPipe);
+        printf("contiguous phases\n");
+        printf("\tas N gates\n\t\t%f (s)\n", durPhases);
+        printf("\tas 1 merged gate\n\t\t%f (s)\n", durMerged);
+        printf("QFT\n");
+        printf("\tusing full circuit\n\t\t%f (s)\n", durCirc);
+        printf("\tusing merged phases\n\t\t%f (s)\n", durAlg);
+        printf("\tusing merged phases, with bit reversal\n\t\t%f (s)\n", durRev);
+        printf("\tusing merged phases, with relabelled output\n\t\t%f (s)\n", durPerm);
+        printf("\t\tthen realising the relabelling\n\t\t%f (s)\n", durReal);
+        printf("\tusing merged phases, with relabelled output, upon a lean statevector\n\t\t%f (s)\n", durLean);
+        printf("\t\t(%.3f MiB per rank, rather than %.3f)\n", 
+            (vec.numLocalAmps + vec.numBufferAmps) * sizeof(amp) / (double) (1 << 20),
+            2 * vec.numLocalAmps * sizeof(amp) / (double) (1 << 20));
+    }
+
+    destroyDistribStatevector(&vec);
+    MPI_Finalize();
+    return 0;
+}
+
+#endif // EXCLUDE_MAIN
@@ -0,0 +1,274 @@
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utilities.h"
+#include "mmaformatter.h"
+#include "binformatter.h"
+#include "counters.h"
+
+
+
+/* a benchmark harness, timing repetitions of a kernel with a monotonic
+ * nanosecond clock, after discarded warm-up repetitions and, optionally, after
+ * evicting the last-level cache so that every repetition starts cold. Unlike
+ * START_TIMING, HARNESS_RUN may be used many times in one scope. Its statistics
+ * include order statistics (robust to the occasional interrupted repetition)
+ * and the bandwidth and throughput implied by the median duration, and 
+ * optionally the per-repetition hardware event counts of counters.h.
+ */
+
+
+
+/* configuration */
+
+// the default of HarnessConfig.countEvents in the benchmarks, set at compile-time by
+// -DHARNESS_COUNT_EVENTS=1
+#ifndef HARNESS_COUNT_EVENTS
+#define HARNESS_COUNT_EVENTS 0
+#endif
+
+typedef struct {
+
+    int numWarmups;         // untimed repetitions preceding the timed
+    int numReps;
+    int flushCache;         // whether to evict the LLC before every repetition
+    int countEvents;        // whether to read the hardware counters around every repetition
+
+    double bytesPerRep;     // memory traffic of one repetition, for bandwidth
+    double ampsPerRep;      // amplitudes processed by one repetition, for throughput
+
+} HarnessConfig;
+
+typedef struct {
+
+    int numReps;
+    double mean, var;
+    double min, median, max;
+    double p5, p95;
+
+    double bandwidth;       // GB/s at the median duration
+    double throughput;      // amplitudes per second at the median duration
+
+    int hasEvents;
+    double events[NUM_PERF_EVENTS];     // mean per repetition, or -1 if uncounted
+
+} HarnessStats;
+
+
+
+/* timing */
+
+FORCE_INLINE double getHarnessTime() {
+
+    // unaffected by NTP slewing, unlike CLOCK_MONOTONIC, and unlike gettimeofday
+#ifdef CLOCK_MONOTONIC_RAW
+    clockid_t clock = CLOCK_MONOTONIC_RAW;
+#else
+    clockid_t clock = CLOCK_MONOTONIC;
+#endif
+    struct timespec t;
+    clock_gettime(clock, &t);
+    return t.tv_sec + 1E-9 * t.tv_nsec;
+}
+
+
+
+/* cache flushing */
+
+// used when the LLC size is unavailable from sysconf
+#define DEFAULT_FLUSH_BYTES (64ULL << 20)
+
+size_t getFlushBytes() {
+
+    // twice the LLC, so that pseudo-LRU replacement cannot retain any earlier line
+    long llc = -1;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (llc <= 0)
+        llc = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    return (llc > 0)? 2 * (size_t) llc : DEFAULT_FLUSH_BYTES;
+}
+
+void flushLastLevelCache() {
+
+    // the buffer persists between calls, and is rewritten by every thread, so
+    // that their private caches are also evicted
+    static double* buffer = NULL;
+    static size_t numDoubles = 0;
+    if (buffer == NULL) {
+        numDoubles = getFlushBytes() / sizeof *buffer;
+        buffer = malloc(numDoubles * sizeof *buffer);
+    }
+
+    size_t i;
+    #pragma omp parallel for shared(buffer,numDoubles) private(i) schedule(static)
+    for (i=0; i<numDoubles; i++)
+        buffer[i] = buffer[i] * 0.5 + 1;
+}
+
+
+
+/* statistics */
+
+int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+double getPercentile(double* sorted, int num, double pct) {
+
+    // linearly interpolates between the closest ranks
+    double pos = (pct/100) * (num - 1);
+    int lo = (int) pos;
+    int hi = (lo + 1 < num)? lo + 1 : lo;
+    return sorted[lo] + (pos - lo) * (sorted[hi] - sorted[lo]);
+}
+
+HarnessStats getEmptyHarnessStats() {
+
+    // flags a benchmark which was not run, as -1 like the existing outputs
+    HarnessStats stats;
+    stats.numReps = 0;
+    stats.mean = stats.var = -1;
+    stats.min = stats.median = stats.max = -1;
+    stats.p5 = stats.p95 = -1;
+    stats.bandwidth = stats.throughput = -1;
+    stats.hasEvents = 0;
+    for (int e=0; e<NUM_PERF_EVENTS; e++)
+        stats.events[e] = -1;
+    return stats;
+}
+
+HarnessStats getHarnessStats(double* durs, double* eventTotals, HarnessConfig cfg) {
+
+    HarnessStats stats;
+    int num = cfg.numReps;
+    stats.numReps = num;
+    getAverageAndVariance(durs, num, &stats.mean, &stats.var);
+
+    double sorted[num];
+    memcpy(sorted, durs, num * sizeof *durs);
+    qsort(sorted, num, sizeof *sorted, compareDoubles);
+
+    stats.min = sorted[0];
+    stats.max = sorted[num-1];
+    stats.median = getPercentile(sorted, num, 50);
+    stats.p5 = getPercentile(sorted, num, 5);
+    stats.p95 = getPercentile(sorted, num, 95);
+
+    stats.bandwidth = cfg.bytesPerRep / stats.median / 1E9;
+    stats.throughput = cfg.ampsPerRep / stats.median;
+
+    // an event is -1 if it could not be counted in any repetition
+    stats.hasEvents = cfg.countEvents;
+    for (int e=0; e<NUM_PERF_EVENTS; e++)
+        stats.events[e] = (cfg.countEvents && eventTotals[e] >= 0)? eventTotals[e] / num : -1;
+    return stats;
+}
+
+
+
+/* running */
+
+/* times CALL (any statement) cfg.numReps times, after cfg.numWarmups untimed
+ * calls, assigning the HarnessStats to STATS. SETUP (any statement, possibly
+ * empty) precedes every call untimed, e.g. to reinitialise the input. Both may
+ * refer to harnessRep, the index of the current call, counting warm-ups. The
+ * counters are read outside of the timed region, so do not perturb the timing.
+ */
+
+#define HARNESS_RUN(CFG, STATS, SETUP, CALL) \
+    do { \
+        HarnessConfig harnessCfg = (CFG); \
+        double harnessDurs[harnessCfg.numReps]; \
+        double harnessEvents[NUM_PERF_EVENTS] = {0}; \
+        for (int harnessRep=0; harnessRep<harnessCfg.numWarmups+harnessCfg.numReps; harnessRep++) { \
+            SETUP; \
+            if (harnessCfg.flushCache) \
+                flushLastLevelCache(); \
+            if (harnessCfg.countEvents) \
+                startPerfCounters(); \
+            double harnessStart = getHarnessTime(); \
+            CALL; \
+            double harnessDur = getHarnessTime() - harnessStart; \
+            if (harnessCfg.countEvents && harnessRep >= harnessCfg.numWarmups) { \
+                double harnessCounts[NUM_PERF_EVENTS]; \
+                stopPerfCounters(harnessCounts); \
+                for (int e=0; e<NUM_PERF_EVENTS; e++) \
+                    harnessEvents[e] = (harnessEvents[e] < 0 || harnessCounts[e] < 0)? \
+                        -1 : harnessEvents[e] + harnessCounts[e]; \
+            } \
+            if (harnessRep >= harnessCfg.numWarmups) \
+                harnessDurs[harnessRep - harnessCfg.numWarmups] = harnessDur; \
+        } \
+        (STATS) = getHarnessStats(harnessDurs, harnessEvents, harnessCfg); \
+    } while (0)
+
+
+
+/* reporting */
+
+void printHarnessStats(HarnessStats stats) {
+
+    printf("\t\t%.6f (s) median, %.6f (s) min, %.3f GB/s, %.3g amps/s\n",
+        stats.median, stats.min, stats.bandwidth, stats.throughput);
+}
+
+// the statistics written per benchmark, followed by the events of counters.h
+#define NUM_HARNESS_STATS 9
+char* harnessStatNames[NUM_HARNESS_STATS] = {"dur", "var", "min", "med", "max", "p5", "p95", "bw", "rate"};
+
+int getNumHarnessColumns(HarnessStats* stats, int len) {
+
+    // the events are included only if any were counted
+    int hasEvents = 0;
+    for (int i=0; i<len; i++)
+        hasEvents |= stats[i].hasEvents;
+    return NUM_HARNESS_STATS + (hasEvents? NUM_PERF_EVENTS : 0);
+}
+
+char* getHarnessColumn(HarnessStats* stats, int len, int col, double* arr) {
+
+    // populates arr with the col-th statistic (or event) of every stats, returning its name
+    for (int i=0; i<len; i++) {
+        HarnessStats s = stats[i];
+        double vals[NUM_HARNESS_STATS] = {s.mean, s.var, s.min, s.median, s.max, s.p5, s.p95, s.bandwidth, s.throughput};
+        arr[i] = (col < NUM_HARNESS_STATS)? vals[col] : s.events[col - NUM_HARNESS_STATS];
+    }
+    return (col < NUM_HARNESS_STATS)? harnessStatNames[col] : perfEventNames[col - NUM_HARNESS_STATS];
+}
+
+void writeHarnessStatsArrToAssoc(FILE* file, char* name, HarnessStats* stats, int len, int precision) {
+
+    // writes every statistic as a separate array, keyed e.g. med_name, and the 
+    // events (keyed e.g. llcMiss_name) if any were counted
+    double arr[len];
+    int numCols = getNumHarnessColumns(stats, len);
+    for (int c=0; c<numCols; c++) {
+        char key[200];
+        sprintf(key, "%s_%s", getHarnessColumn(stats, len, c, arr), name);
+        writeDoubleArrToAssoc(file, key, arr, len, precision);
+    }
+}
+
+void writeHarnessStatsArrToBinary(FILE* file, char* name, HarnessStats* stats, int len) {
+
+    // as writeHarnessStatsArrToAssoc, to a file of binformatter.h
+    double arr[len];
+    int numCols = getNumHarnessColumns(stats, len);
+    for (int c=0; c<numCols; c++) {
+        char key[200];
+        sprintf(key, "%s_%s", getHarnessColumn(stats, len, c, arr), name);
+        writeDoubleArrToBinary(file, key, arr, len);
+    }
+}
+
+
+
+#endif // HARNESS_H
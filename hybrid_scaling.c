@@ -0,0 +1,333 @@
+/* Hybrid MPI+OpenMP scaling of every local control method (s_methods and
+ * m_methods of local_controls.c, distributed as in distributed_controls.c) and
+ * both distributed QFTs of distributed_qft.c, to choose between more ranks per
+ * node and more threads per rank. A single run measures strong scaling (a fixed
+ * numQubits upon 1, 2, 4, ... numRanks ranks) and weak scaling (a fixed
+ * numLocalQubits per rank), by splitting the launched ranks into ever larger
+ * communicators while the remaining ranks sleep. Launch once per combination
+ * of ranks per node and OMP_NUM_THREADS.
+ *
+ * Each rank splits the duration of a kernel into comm (within MPI calls moving
+ * amplitudes), wait (blocked upon outstanding messages, or at the following
+ * barrier upon slower ranks) and compute (the remainder), using the commTimes
+ * of distributed.h. The min, max and avg of each part over the ranks are
+ * written to a single association, per kernel, as lists over the rank counts.
+ *
+ * It is important that inline functions are actually inlined, so pass optimisation
+ * flags (especially with Clang)
+ * run with:
+ *      mpicc hybrid_scaling.c -O3 -lm -fopenmp -o scaling
+ *      OMP_NUM_THREADS=T mpirun -np 2^R ./scaling strongQubits weakLocalQubits numReps outFN
+ */
+
+#ifdef EXCLUDE_MAIN
+#include "distributed_controls.c"
+#include "distributed_qft.c"
+#else
+#define EXCLUDE_MAIN
+#include "distributed_controls.c"
+#include "distributed_qft.c"
+#undef EXCLUDE_MAIN
+#endif
+
+#include <unistd.h>
+
+
+
+/* distributed methods */
+
+/* the rank-control handling of distributed_controls.c, about any local method */
+
+void s_hybridMethod(int m, qreal* amps, INDEX numLocalAmps, int c, int rank) {
+    int L = getNumLocalQubits(numLocalAmps);
+    if (c < L)
+        s_methods[m](amps, numLocalAmps, c);
+    else if (getBit(rank, c-L))
+        applyUncontrolled(amps, numLocalAmps);
+}
+
+void m_hybridMethod(int m, qreal* amps, INDEX numLocalAmps, int* ctrls, int numCtrls, int rank) {
+    int L = getNumLocalQubits(numLocalAmps);
+
+    int localCtrls[numCtrls];
+    int numLocalCtrls = 0;
+    for (int c=0; c<numCtrls; c++) {
+        if (ctrls[c] < L)
+            localCtrls[numLocalCtrls++] = ctrls[c];
+        else if (!getBit(rank, ctrls[c]-L))
+            return;
+    }
+
+    if (numLocalCtrls == 0)
+        applyUncontrolled(amps, numLocalAmps);
+    else
+        m_methods[m](amps, numLocalAmps, localCtrls, numLocalCtrls);
+}
+
+
+
+/* kernels */
+
+/* kernels are indexed as the s_methods, then the m_methods, then the two QFTs.
+ * A repetition of an s method applies it once per control qubit, and of an m
+ * method once per number of controls (from 2 to numQubits, at random positions
+ * seeded identically upon every rank), each upon a freshly initialised array
+ */
+
+#define NUM_HYBRID_KERNELS (NUM_S_METHODS + NUM_M_METHODS + 2)
+#define HYBRID_QFT_CIRCUIT (NUM_S_METHODS + NUM_M_METHODS)
+#define HYBRID_QFT_ALGORITHM (HYBRID_QFT_CIRCUIT + 1)
+
+void getHybridKernelName(int k, char* name) {
+    if (k < NUM_S_METHODS)
+        sprintf(name, "s_%s", s_methodNames[k]);
+    else if (k < HYBRID_QFT_CIRCUIT)
+        sprintf(name, "m_%s", m_methodNames[k - NUM_S_METHODS]);
+    else
+        strcpy(name, (k == HYBRID_QFT_CIRCUIT)? "qftCircuit" : "qftAlgorithm");
+}
+
+int getNumHybridKernelSteps(int k, int numQubits) {
+    if (k < NUM_S_METHODS)
+        return numQubits;
+    if (k < HYBRID_QFT_CIRCUIT)
+        return numQubits - 1;
+    return 1;
+}
+
+void applyHybridKernelStep(int k, int step, qreal* amps, DistribStatevector* vec) {
+    if (k < NUM_S_METHODS)
+        s_hybridMethod(k, amps, vec->numLocalAmps, step, vec->rank);
+
+    else if (k < HYBRID_QFT_CIRCUIT) {
+        int numCtrls = step + 2;
+        int ctrls[numCtrls];
+        getSortedRandomSubReg(ctrls, numCtrls, vec->numQubits);
+        m_hybridMethod(k - NUM_S_METHODS, amps, vec->numLocalAmps, ctrls, numCtrls, vec->rank);
+    }
+    else if (k == HYBRID_QFT_CIRCUIT)
+        applyDistribQFTCircuit(vec);
+    else
+        applyDistribQFTAlgorithm(vec);
+}
+
+
+
+/* timing */
+
+#define NUM_TIME_PARTS 4
+char* timePartNames[NUM_TIME_PARTS] = {"total", "compute", "comm", "wait"};
+
+typedef struct {
+
+    double min[NUM_TIME_PARTS];
+    double max[NUM_TIME_PARTS];
+    double avg[NUM_TIME_PARTS];
+
+} HybridStats;
+
+void timeHybridKernel(int k, qreal* amps, DistribStatevector* vec, int numReps, double* parts) {
+
+    // parts receives this rank's average duration per rep of each time part
+    for (int p=0; p<NUM_TIME_PARTS; p++)
+        parts[p] = 0;
+
+    int isControls = k < HYBRID_QFT_CIRCUIT;
+    int numSteps = getNumHybridKernelSteps(k, vec->numQubits);
+
+    for (int r=0; r<numReps; r++) {
+        srand(123456789 + r);
+
+        for (int s=0; s<numSteps; s++) {
+            if (isControls)
+                initArray(amps, vec->numLocalAmps);
+            commTimes.comm = 0;
+            commTimes.wait = 0;
+
+            MPI_Barrier(vec->comm);
+            double start = MPI_Wtime();
+            applyHybridKernelStep(k, s, amps, vec);
+            double finish = MPI_Wtime();
+            MPI_Barrier(vec->comm);
+            double end = MPI_Wtime();
+
+            parts[0] += end - start;
+            parts[2] += commTimes.comm;
+            parts[3] += commTimes.wait + (end - finish);
+        }
+    }
+
+    parts[1] = parts[0] - parts[2] - parts[3];
+    for (int p=0; p<NUM_TIME_PARTS; p++)
+        parts[p] /= numReps;
+}
+
+HybridStats reduceHybridTimes(double* parts, MPI_Comm comm) {
+
+    // the statistics are only populated upon rank 0 of comm
+    HybridStats stats;
+    int numRanks;
+    MPI_Comm_size(comm, &numRanks);
+    MPI_Reduce(parts, stats.min, NUM_TIME_PARTS, MPI_DOUBLE, MPI_MIN, 0, comm);
+    MPI_Reduce(parts, stats.max, NUM_TIME_PARTS, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(parts, stats.avg, NUM_TIME_PARTS, MPI_DOUBLE, MPI_SUM, 0, comm);
+    for (int p=0; p<NUM_TIME_PARTS; p++)
+        stats.avg[p] /= numRanks;
+    return stats;
+}
+
+
+
+/* scaling */
+
+void waitIdly(MPI_Comm comm) {
+
+    // ranks outside the measured communicator sleep, rather than spinning in a
+    // barrier upon the cores of the measured ranks' threads
+    MPI_Request req;
+    int isDone = 0;
+    MPI_Ibarrier(comm, &req);
+    while (!isDone) {
+        usleep(1000);
+        MPI_Test(&req, &isDone, MPI_STATUS_IGNORE);
+    }
+}
+
+void runHybridScaling(int isWeak, int numQubits, int numReps, int numRankCounts, HybridStats stats[][numRankCounts]) {
+
+    // numQubits is the total (strong) or local (weak) number of qubits
+    int worldRank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &worldRank);
+
+    for (int i=0; i<numRankCounts; i++) {
+        int numRanks = 1 << i;
+        MPI_Comm comm;
+        MPI_Comm_split(MPI_COMM_WORLD, (worldRank < numRanks)? 0 : MPI_UNDEFINED, worldRank, &comm);
+
+        if (comm != MPI_COMM_NULL) {
+            int N = isWeak? numQubits + i : numQubits;
+            DistribStatevector vec = createDistribStatevector(N, comm);
+            initSeededDistribStatevector(&vec, 123456789);
+            qreal* amps = malloc(vec.numLocalAmps * sizeof *amps);
+
+            for (int k=0; k<NUM_HYBRID_KERNELS; k++) {
+                double parts[NUM_TIME_PARTS];
+                timeHybridKernel(k, amps, &vec, numReps, parts);
+                stats[k][i] = reduceHybridTimes(parts, comm);
+            }
+
+            if (vec.rank == 0)
+                printf("%s: %d qubits upon %d ranks done\n", isWeak? "weak" : "strong", N, numRanks);
+
+            free(amps);
+            destroyDistribStatevector(&vec);
+            MPI_Comm_free(&comm);
+        }
+
+        waitIdly(MPI_COMM_WORLD);
+    }
+}
+
+
+
+/* launch */
+
+#ifndef EXCLUDE_MAIN
+
+void writeHybridStatsToAssoc(FILE* file, char* prefix, int numRankCounts, HybridStats stats[][numRankCounts], int outPrec) {
+
+    // keys like strong_s_D_comm_max, each a list over the rank counts
+    for (int k=0; k<NUM_HYBRID_KERNELS; k++) {
+        char kernelName[50];
+        getHybridKernelName(k, kernelName);
+
+        for (int p=0; p<NUM_TIME_PARTS; p++) {
+            double mins[numRankCounts], maxs[numRankCounts], avgs[numRankCounts];
+            for (int i=0; i<numRankCounts; i++) {
+                mins[i] = stats[k][i].min[p];
+                maxs[i] = stats[k][i].max[p];
+                avgs[i] = stats[k][i].avg[p];
+            }
+
+            char key[100];
+            sprintf(key, "%s_%s_%s_min", prefix, kernelName, timePartNames[p]);
+            writeDoubleArrToAssoc(file, key, mins, numRankCounts, outPrec);
+            sprintf(key, "%s_%s_%s_max", prefix, kernelName, timePartNames[p]);
+            writeDoubleArrToAssoc(file, key, maxs, numRankCounts, outPrec);
+            sprintf(key, "%s_%s_%s_avg", prefix, kernelName, timePartNames[p]);
+            writeDoubleArrToAssoc(file, key, avgs, numRankCounts, outPrec);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+
+    MPI_Init(&argc, &argv);
+
+    int rank, numRanks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &numRanks);
+
+    if (argc != 5) {
+        if (rank == 0)
+            printf("call as:\n\tmpirun -np 2^R ./scaling strongQubits weakLocalQubits numReps outFN\n");
+        MPI_Finalize();
+        return 0;
+    }
+
+    int strongQubits = atoi(argv[1]);
+    int weakLocalQubits = atoi(argv[2]);
+    int numReps = atoi(argv[3]);
+    char* outFN = argv[4];
+
+    // the rank counts 1, 2, 4, ... numRanks
+    int numRankCounts = 1;
+    while ((1 << (numRankCounts-1)) < numRanks)
+        numRankCounts++;
+    if ((1 << (numRankCounts-1)) != numRanks || numRankCounts-1 > strongQubits) {
+        if (rank == 0)
+            printf("the number of ranks must be a power of 2, no larger than 2^strongQubits\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    int numThreads = omp_get_max_threads();
+    if (rank == 0)
+        printf("[%d ranks, %d threads per rank]\n\n", numRanks, numThreads);
+
+    HybridStats (*strongStats)[numRankCounts] = malloc(NUM_HYBRID_KERNELS * sizeof *strongStats);
+    HybridStats (*weakStats)[numRankCounts] = malloc(NUM_HYBRID_KERNELS * sizeof *weakStats);
+    runHybridScaling(0, strongQubits, numReps, numRankCounts, strongStats);
+    runHybridScaling(1, weakLocalQubits, numReps, numRankCounts, weakStats);
+
+    if (rank == 0) {
+        int outPrec = 8;
+        int rankCounts[numRankCounts];
+        int weakQubits[numRankCounts];
+        for (int i=0; i<numRankCounts; i++) {
+            rankCounts[i] = 1 << i;
+            weakQubits[i] = weakLocalQubits + i;
+        }
+
+        FILE* file = openAssocWrite(outFN);
+        writeStringToAssoc(file, "precision", PRECISION_NAME);
+        writeStringToAssoc(file, "note", "timings are already per-rep, in seconds; total = compute + comm + wait upon each rank");
+        writeIntToAssoc(file, "numThreads", numThreads);
+        writeIntToAssoc(file, "numReps", numReps);
+        writeIntToAssoc(file, "outPrec", outPrec);
+        writeIntArrToAssoc(file, "rankCounts", rankCounts, numRankCounts);
+        writeIntToAssoc(file, "strongNumQubits", strongQubits);
+        writeIntToAssoc(file, "weakNumLocalQubits", weakLocalQubits);
+        writeIntArrToAssoc(file, "weakNumQubits", weakQubits, numRankCounts);
+        writeHybridStatsToAssoc(file, "strong", numRankCounts, strongStats, outPrec);
+        writeHybridStatsToAssoc(file, "weak", numRankCounts, weakStats, outPrec);
+        closeAssocWrite(file);
+    }
+
+    free(strongStats);
+    free(weakStats);
+    MPI_Finalize();
+    return 0;
+}
+
+#endif // EXCLUDE_MAIN
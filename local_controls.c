@@ -3,38 +3,57 @@
  * incorporating single (s_) and multiple (m_) control qubits into 
  * simulation of a single-target unitary gate. Note the extension
  * to distributed simulation requires edge cases for all methods (except 
- * A & B), to handle the scenarios when none or all local amplitudes
- * pass the control condition.
+ * A, B & BV), to handle the scenarios when none or all local amplitudes
+ * pass the control condition. These are implemented in distributed_controls.c
  *
  * As a matter of convenience, this function will use real arrays in lieu of 
- * complex statevectors.
+ * complex statevectors, of floats when compiled with -DPRECISION=1.
  *
  * It is important that inline functions are actually inlined, so pass optimisation
  * flags (especially with Clang)
  * run with:
  *      gcc local_controls.c -O3 -lm -fopenmp -o test
  *      ./test
+ * adding -DHARNESS_COUNT_EVENTS=1 to also record hardware counters (counters.h)
+ * in the benchmark outputs. Mode r reports each method's attainment of the 
+ * host's roofline (roofline.h).
+ *
+ * applyControlled() dispatches to whichever method was measured fastest for the
+ * given controls, once initControlTuning() has calibrated or loaded a profile.
+ *
+ * The u_ methods apply the same strategies to a real gate, a controlled 2x2
+ * complex unitary upon a target, with applyControlledUnitary() as the 
+ * production kernel. Modes us and um sweep them like s and m, as
+ *      ./test [us/um] numQubits target numReps outFN
  */
 
 #include "utilities.h"
 #include "mmaformatter.h"
+#include "harness.h"
+#include "roofline.h"
+
+#include <assert.h>
 
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 
 
 /* array management */
 
-void printSubArray(double* amps, INDEX numAmps) {
+void printSubArray(qreal* amps, INDEX numAmps) {
     for (INDEX i=0; i<numAmps; i++) {
         printf("amp[%lld] = %g\n", i, amps[i]);
     }
     printf("\n");
 }
 
-void initArray(double* amps, INDEX numAmps) {
+void initArray(qreal* amps, INDEX numAmps) {
     for (INDEX i=0; i<numAmps; i++)
         amps[i] = 1;
 }
@@ -47,9 +66,67 @@ void initArray(double* amps, INDEX numAmps) {
 
 
 
+/* vectorised blend */
+
+/* Methods B scan every amplitude without branching, but blend arithmetically,
+ * which costs flops and does not always vectorise. Here a vector of the lane
+ * indices is compared against the control mask, lane-wise, and f (evaluated
+ * in every lane) is stored only to the passing lanes, by a masked store 
+ * (AVX-512) or a vblendvpd (AVX2). This is a fair vectorised full scan, to
+ * compare against the skipping methods. Single precision, and hosts without
+ * AVX2, fall back to a scalar select, which compilers emit as a cmov.
+ */
+
+#if PRECISION == 2 && defined(__AVX512F__)
+#define BLEND_WIDTH 8
+#elif PRECISION == 2 && defined(__AVX2__)
+#define BLEND_WIDTH 4
+#else
+#define BLEND_WIDTH 1
+#endif
+
+void applyMaskedBlend(qreal* amps, INDEX numAmps, INDEX cMask) {
+    
+    // too few amps to fill a vector
+    INDEX i;
+    if (BLEND_WIDTH == 1 || numAmps < BLEND_WIDTH) {
+        #pragma omp parallel for shared(amps,numAmps,cMask) private(i) schedule(static)
+        for (i=0; i<numAmps; i++)
+            amps[i] = bitsAreAllOne(i, cMask)? f(amps[i]) : amps[i];
+        return;
+    }
+    
+#if BLEND_WIDTH == 8
+    #pragma omp parallel for shared(amps,numAmps,cMask) private(i) schedule(static)
+    for (i=0; i<numAmps; i+=8) {
+        __m512i inds = _mm512_add_epi64(_mm512_set1_epi64(i), _mm512_set_epi64(7,6,5,4,3,2,1,0));
+        __m512i mask = _mm512_set1_epi64(cMask);
+        __mmask8 pass = _mm512_cmpeq_epi64_mask(_mm512_and_si512(inds, mask), mask);
+        
+        __m512d d = _mm512_sub_pd(_mm512_loadu_pd(&amps[i]), _mm512_set1_pd(.1));
+        __m512d fa = _mm512_mul_pd(_mm512_set1_pd(1.5), _mm512_mul_pd(d, d));
+        _mm512_mask_storeu_pd(&amps[i], pass, fa);
+    }
+#elif BLEND_WIDTH == 4
+    #pragma omp parallel for shared(amps,numAmps,cMask) private(i) schedule(static)
+    for (i=0; i<numAmps; i+=4) {
+        __m256i inds = _mm256_add_epi64(_mm256_set1_epi64x(i), _mm256_set_epi64x(3,2,1,0));
+        __m256i mask = _mm256_set1_epi64x(cMask);
+        __m256i pass = _mm256_cmpeq_epi64(_mm256_and_si256(inds, mask), mask);
+        
+        __m256d a = _mm256_loadu_pd(&amps[i]);
+        __m256d d = _mm256_sub_pd(a, _mm256_set1_pd(.1));
+        __m256d fa = _mm256_mul_pd(_mm256_set1_pd(1.5), _mm256_mul_pd(d, d));
+        _mm256_storeu_pd(&amps[i], _mm256_blendv_pd(a, fa, _mm256_castsi256_pd(pass)));
+    }
+#endif
+}
+
+
+
 /* single control methods */
 
-void s_methodA(double* amps, INDEX numAmps, int c) {
+void s_methodA(qreal* amps, INDEX numAmps, int c) {
     INDEX i;
     #pragma omp parallel for shared(amps,numAmps,c) private(i) schedule(static)
     for (i=0; i<numAmps; i++)
@@ -57,7 +134,7 @@ void s_methodA(double* amps, INDEX numAmps, int c) {
             amps[i] = f(amps[i]);
 }
 
-void s_methodB(double* amps, INDEX numAmps, int c) {
+void s_methodB(qreal* amps, INDEX numAmps, int c) {
     INDEX i; int b;
     #pragma omp parallel for shared(amps,numAmps,c) private(i,b) schedule(static)
     for (i=0; i<numAmps; i++) {
@@ -66,7 +143,7 @@ void s_methodB(double* amps, INDEX numAmps, int c) {
     }
 }
 
-void s_methodC(double* amps, INDEX numAmps, int c) {
+void s_methodC(qreal* amps, INDEX numAmps, int c) {
     INDEX jNum = numAmps >> (c+1);
     INDEX iNum = pow2(c);
     INDEX j,i,j0i,j1i;
@@ -75,12 +152,12 @@ void s_methodC(double* amps, INDEX numAmps, int c) {
         for (i=0; i<iNum; i++) {
             j0i = getZeroBitFromAffix(j, i, c);
             j1i = flipBit(j0i, c);
-            amps[j1i] = f(amps[i]);
+            amps[j1i] = f(amps[j1i]);
         }
     }
 }
 
-void s_methodD(double* amps, INDEX numAmps, int c) {
+void s_methodD(qreal* amps, INDEX numAmps, int c) {
     INDEX l1 = numAmps >> 1;
     INDEX m,i;
     #pragma omp parallel for shared(amps,numAmps,c,l1) private(m,i) schedule(static)
@@ -90,17 +167,80 @@ void s_methodD(double* amps, INDEX numAmps, int c) {
     }
 }
 
+void s_methodBV(qreal* amps, INDEX numAmps, int c) {
+    applyMaskedBlend(amps, numAmps, pow2(c));
+}
+
+/* Method C recovers j and i from its collapsed iteration by a division and
+ * modulo each. Methods CB and CG instead split the flattened space of the 
+ * numAmps/2 passing amplitudes into runs, locate the first amplitude of each 
+ * run once, and then stream, stepping over every failing block of 2^c by a 
+ * rarely-taken branch. CB gives each thread one contiguous run, while CG deals
+ * out runs of CONTROL_RUN_AMPS under a guided schedule, which balances the 
+ * load however few blocks there are (e.g. c = N-1, where jNum = 1).
+ */
+
+#define CONTROL_RUN_AMPS 4096
 
-void (*s_methods[4]) (double* amps, INDEX numAmps, int c) = {
-    s_methodA, s_methodB, s_methodC, s_methodD
+FORCE_INLINE void applyControlledRun(qreal* amps, INDEX mStart, INDEX mEnd, int c) {
+    
+    // the m-th passing amplitude is |m >> c>|1>|m mod 2^c>
+    INDEX cBit = pow2(c);
+    INDEX j1i = flipBit(insertZeroBit(mStart, c), c);
+    for (INDEX m=mStart; m<mEnd; m++) {
+        amps[j1i] = f(amps[j1i]);
+        j1i++;
+        if (!(j1i & cBit))
+            j1i |= cBit;
+    }
+}
+
+void s_methodCB(qreal* amps, INDEX numAmps, int c) {
+    INDEX numPassing = numAmps >> 1;
+    
+    #pragma omp parallel shared(amps,numPassing,c)
+    {
+#ifdef _OPENMP
+        INDEX id = omp_get_thread_num();
+        INDEX numThreads = omp_get_num_threads();
+#else
+        INDEX id = 0;
+        INDEX numThreads = 1;
+#endif
+        INDEX mStart = (numPassing * id) / numThreads;
+        INDEX mEnd = (numPassing * (id+1)) / numThreads;
+        applyControlledRun(amps, mStart, mEnd, c);
+    }
+}
+
+void s_methodCG(qreal* amps, INDEX numAmps, int c) {
+    INDEX numPassing = numAmps >> 1;
+    INDEX numRuns = (numPassing + CONTROL_RUN_AMPS - 1) / CONTROL_RUN_AMPS;
+    INDEX r;
+    #pragma omp parallel for shared(amps,numPassing,c,numRuns) private(r) schedule(guided)
+    for (r=0; r<numRuns; r++) {
+        INDEX mEnd = (r+1) * CONTROL_RUN_AMPS;
+        applyControlledRun(amps, r * CONTROL_RUN_AMPS, (mEnd < numPassing)? mEnd : numPassing, c);
+    }
+}
+
+
+#define NUM_S_METHODS 7
+
+void (*s_methods[NUM_S_METHODS]) (qreal* amps, INDEX numAmps, int c) = {
+    s_methodA, s_methodB, s_methodC, s_methodD, s_methodBV, s_methodCB, s_methodCG
 };
-char* s_methodNames[4] = {"A", "B", "C", "D"};
+char* s_methodNames[NUM_S_METHODS] = {"A", "B", "C", "D", "BV", "CB", "CG"};
+
+// whether each method reads and writes every amplitude, rather than only those 
+// passing: 1 if it also blends arithmetically, 2 if by a masked store
+int s_methodsAreDense[NUM_S_METHODS] = {0, 1, 0, 0, 2, 0, 0};
 
 
 
 /* many control methods */
 
-void m_methodA(double* amps, INDEX numAmps, int* ctrls, int numCtrls) {
+void m_methodA(qreal* amps, INDEX numAmps, int* ctrls, int numCtrls) {
     INDEX cMask = getBitMask(ctrls, numCtrls);
     INDEX i;
     #pragma omp parallel for shared(amps,numAmps,ctrls,numCtrls,cMask) private(i) schedule(static)
@@ -109,7 +249,7 @@ void m_methodA(double* amps, INDEX numAmps, int* ctrls, int numCtrls) {
             amps[i] = f(amps[i]);
 }
 
-void m_methodB(double* amps, INDEX numAmps, int* ctrls, int numCtrls) {
+void m_methodB(qreal* amps, INDEX numAmps, int* ctrls, int numCtrls) {
     INDEX cMask = getBitMask(ctrls, numCtrls);
     INDEX i; int b;
     #pragma omp parallel for shared(amps,numAmps,ctrls,numCtrls,cMask) private(i,b) schedule(static)
@@ -119,7 +259,7 @@ void m_methodB(double* amps, INDEX numAmps, int* ctrls, int numCtrls) {
     }
 }
 
-void m_methodD(double* amps, INDEX numAmps, int* ctrls, int numCtrls) {
+void m_methodD(qreal* amps, INDEX numAmps, int* ctrls, int numCtrls) {
     INDEX lNum = numAmps >> numCtrls;
     INDEX l,j; int c;
     #pragma omp parallel for shared(amps,numAmps,ctrls,numCtrls,lNum) private(l,j,c) schedule(static)
@@ -131,21 +271,427 @@ void m_methodD(double* amps, INDEX numAmps, int* ctrls, int numCtrls) {
     }
 }
 
-void (*m_methods[3]) (double* amps, INDEX numAmps, int* ctrls, int numCtrls) = {
-    m_methodA, m_methodB, m_methodD
+void m_methodE(qreal* amps, INDEX numAmps, int* ctrls, int numCtrls) {
+    // passing amps form runs of 2^ctrls[0] contiguous indices, and each run start 
+    // follows from the previous by a masked increment of the non-control bits
+    INDEX cMask = getBitMask(ctrls, numCtrls);
+    INDEX runLen = pow2(ctrls[0]);
+    INDEX freeMask = (numAmps-1) & ~cMask & ~(runLen-1);
+    INDEX numRuns = (numAmps >> numCtrls) >> ctrls[0];
+    
+    #pragma omp parallel shared(amps,numAmps,ctrls,numCtrls,cMask,runLen,freeMask,numRuns)
+    {
+#ifdef _OPENMP
+        INDEX id = omp_get_thread_num();
+        INDEX numThreads = omp_get_num_threads();
+#else
+        INDEX id = 0;
+        INDEX numThreads = 1;
+#endif
+        // each thread takes a contiguous range of runs, locating only the first
+        INDEX rStart = (numRuns * id) / numThreads;
+        INDEX rEnd = (numRuns * (id+1)) / numThreads;
+        
+        INDEX j = rStart << ctrls[0];
+        for (int c=0; c<numCtrls; c++)
+            j = flipBit(insertZeroBit(j, ctrls[c]), ctrls[c]);
+        
+        for (INDEX r=rStart; r<rEnd; r++) {
+            for (INDEX i=j; i<j+runLen; i++)
+                amps[i] = f(amps[i]);
+            j = (((j | ~freeMask) + 1) & freeMask) | cMask;
+        }
+    }
+}
+
+void m_methodBV(qreal* amps, INDEX numAmps, int* ctrls, int numCtrls) {
+    applyMaskedBlend(amps, numAmps, getBitMask(ctrls, numCtrls));
+}
+
+#define NUM_M_METHODS 5
+
+void (*m_methods[NUM_M_METHODS]) (qreal* amps, INDEX numAmps, int* ctrls, int numCtrls) = {
+    m_methodA, m_methodB, m_methodD, m_methodE, m_methodBV
+};
+char* m_methodNames[NUM_M_METHODS] = {"A", "B", "D", "E", "BV"};
+
+int m_methodsAreDense[NUM_M_METHODS] = {0, 1, 0, 0, 2};
+
+
+
+/* controlled unitary */
+
+/* The methods above modify each passing amplitude independently, by the real
+ * stand-in f. A real gate instead pairs |..0..> and |..1..> of its target t,
+ * applying a 2x2 complex matrix u (row-major, like the fused gates of 
+ * local_qft.c) to every pair whose controls are all one, so reads and writes
+ * two amplitudes 2^t apart. The u_ methods mirror the control strategies over
+ * the numAmps/2 pairs: A branches, B blends arithmetically, D builds each
+ * passing pair from its rank by inserting the sorted control and target bits,
+ * and E streams the runs of contiguous pairs below the lowest of those bits.
+ * The controls need not be sorted, but must be distinct and must not include t.
+ */
+
+FORCE_INLINE void applyUnitaryToPair(amp* psi, INDEX i0, int t, amp* u) {
+    INDEX i1 = flipBit(i0, t);
+    amp a0 = psi[i0];
+    amp a1 = psi[i1];
+    psi[i0] = u[0]*a0 + u[1]*a1;
+    psi[i1] = u[2]*a0 + u[3]*a1;
+}
+
+void getSortedPairBits(int* ctrls, int numCtrls, int t, int* bits) {
+    
+    // the controls and target, by insertion sort
+    bits[0] = t;
+    for (int n=0; n<numCtrls; n++) {
+        assert(ctrls[n] != t);
+        int i = n+1;
+        while (i > 0 && bits[i-1] > ctrls[n]) {
+            bits[i] = bits[i-1];
+            i--;
+        }
+        bits[i] = ctrls[n];
+    }
+}
+
+void u_methodA(amp* psi, INDEX numAmps, int* ctrls, int numCtrls, int t, amp* u) {
+    INDEX cMask = getBitMask(ctrls, numCtrls);
+    INDEX numPairs = numAmps >> 1;
+    INDEX m,i0;
+    #pragma omp parallel for shared(psi,numPairs,t,u,cMask) private(m,i0) schedule(static)
+    for (m=0; m<numPairs; m++) {
+        i0 = insertZeroBit(m, t);
+        if (bitsAreAllOne(i0, cMask))
+            applyUnitaryToPair(psi, i0, t, u);
+    }
+}
+
+void u_methodB(amp* psi, INDEX numAmps, int* ctrls, int numCtrls, int t, amp* u) {
+    INDEX cMask = getBitMask(ctrls, numCtrls);
+    INDEX numPairs = numAmps >> 1;
+    INDEX m,i0,i1; int b;
+    amp a0, a1;
+    #pragma omp parallel for shared(psi,numPairs,t,u,cMask) private(m,i0,i1,b,a0,a1) schedule(static)
+    for (m=0; m<numPairs; m++) {
+        i0 = insertZeroBit(m, t);
+        i1 = flipBit(i0, t);
+        b = bitsAreAllOne(i0, cMask);
+        a0 = psi[i0];
+        a1 = psi[i1];
+        psi[i0] = (1-b)*a0 + b*(u[0]*a0 + u[1]*a1);
+        psi[i1] = (1-b)*a1 + b*(u[2]*a0 + u[3]*a1);
+    }
+}
+
+void u_methodD(amp* psi, INDEX numAmps, int* ctrls, int numCtrls, int t, amp* u) {
+    int bits[numCtrls+1];
+    getSortedPairBits(ctrls, numCtrls, t, bits);
+    INDEX cMask = getBitMask(ctrls, numCtrls);
+    INDEX lNum = numAmps >> (numCtrls+1);
+    INDEX l,j; int b;
+    #pragma omp parallel for shared(psi,lNum,numCtrls,bits,t,u,cMask) private(l,j,b) schedule(static)
+    for (l=0; l<lNum; l++) {
+        j = l;
+        for (b=0; b<=numCtrls; b++)
+            j = insertZeroBit(j, bits[b]);
+        applyUnitaryToPair(psi, j | cMask, t, u);
+    }
+}
+
+void u_methodE(amp* psi, INDEX numAmps, int* ctrls, int numCtrls, int t, amp* u) {
+    // the passing pairs form runs of 2^bits[0] contiguous i0, and each run start 
+    // follows from the previous by a masked increment of the free bits, which
+    // exclude the target so that i0 keeps it zero
+    int bits[numCtrls+1];
+    getSortedPairBits(ctrls, numCtrls, t, bits);
+    INDEX cMask = getBitMask(ctrls, numCtrls);
+    INDEX runLen = pow2(bits[0]);
+    INDEX freeMask = (numAmps-1) & ~cMask & ~pow2(t) & ~(runLen-1);
+    INDEX numRuns = (numAmps >> (numCtrls+1)) >> bits[0];
+    
+    #pragma omp parallel shared(psi,numCtrls,bits,t,u,cMask,runLen,freeMask,numRuns)
+    {
+#ifdef _OPENMP
+        INDEX id = omp_get_thread_num();
+        INDEX numThreads = omp_get_num_threads();
+#else
+        INDEX id = 0;
+        INDEX numThreads = 1;
+#endif
+        // each thread takes a contiguous range of runs, locating only the first
+        INDEX rStart = (numRuns * id) / numThreads;
+        INDEX rEnd = (numRuns * (id+1)) / numThreads;
+        
+        INDEX j = rStart << bits[0];
+        for (int b=0; b<=numCtrls; b++)
+            j = insertZeroBit(j, bits[b]);
+        j |= cMask;
+        
+        for (INDEX r=rStart; r<rEnd; r++) {
+            for (INDEX i=j; i<j+runLen; i++)
+                applyUnitaryToPair(psi, i, t, u);
+            j = (((j | ~freeMask) + 1) & freeMask) | cMask;
+        }
+    }
+}
+
+#define NUM_U_METHODS 4
+
+void (*u_methods[NUM_U_METHODS]) (amp* psi, INDEX numAmps, int* ctrls, int numCtrls, int t, amp* u) = {
+    u_methodA, u_methodB, u_methodD, u_methodE
 };
-char* m_methodNames[3] = {"A", "B", "D"};
+char* u_methodNames[NUM_U_METHODS] = {"A", "B", "D", "E"};
+
+void applyControlledUnitary(amp* psi, INDEX numAmps, int* ctrls, int numCtrls, int t, amp* u) {
+    
+    // the production kernel, via method E, the run-based refinement of the direct
+    // enumeration of method D, which both only visit the pairs passing the controls
+    u_methodE(psi, numAmps, ctrls, numCtrls, t, u);
+}
 
 
 
+/* roofline costs */
 
-/* launch */
+/* the memory traffic and flops which a method's access pattern implies. A 
+ * sparse method reads and writes only the passing amplitudes, but memory moves
+ * whole cache lines, so controls below the line width skip no traffic. A dense
+ * method additionally evaluates f and blends every amplitude.
+ */
+
+#define LINE_QUBITS (PRECISION == 1? 4 : 3)    // 64-byte lines of 16 floats or 8 doubles
+#define FLOPS_PER_F 3               // (amp - .1)^2 * 1.5, with pow(,2) as a square
+#define FLOPS_PER_BLEND 4           // (1-b)*amp + b*f(amp)
+
+void getMethodCost(int isDense, INDEX numAmps, int* ctrls, int numCtrls, double* numBytes, double* numFlops) {
+    
+    INDEX numPassing = numAmps >> numCtrls;
+    
+    if (isDense) {
+        *numBytes = 2 * sizeof(qreal) * (double) numAmps;
+        *numFlops = (FLOPS_PER_F + ((isDense == 1)? FLOPS_PER_BLEND : 0)) * (double) numAmps;
+        return;
+    }
+    
+    int numLineCtrls = 0;
+    for (int c=0; c<numCtrls; c++)
+        numLineCtrls += (ctrls[c] >= LINE_QUBITS);
+    
+    *numBytes = 2 * sizeof(qreal) * (double) (numAmps >> numLineCtrls);
+    *numFlops = FLOPS_PER_F * (double) numPassing;
+}
+
+
+
+/* autotuned dispatch */
+
+/* no single method is fastest everywhere; the best depends upon the control 
+ * position (single control) or the number of controls (many controls), and 
+ * upon the statevector size and number of threads. A ControlTuning records 
+ * the measured-fastest method for every case at a given size and thread count,
+ * and is either calibrated by timing every method, or loaded from a profile 
+ * file previously saved by a calibration. Profiles identify methods by name, 
+ * so remain valid when the method arrays are reordered or extended.
+ */
+
+#define TUNING_MAX_QUBITS 64
+
+// used when no tuning matches the statevector size or thread count
+#define DEFAULT_S_METHOD 3
+#define DEFAULT_M_METHOD 3
+
+typedef struct {
+    
+    int numQubits;
+    int numThreads;
+    
+    int s_best[TUNING_MAX_QUBITS];      // indexed by the control qubit
+    int m_best[TUNING_MAX_QUBITS+1];    // indexed by the number of controls
+    
+} ControlTuning;
+
+ControlTuning activeTuning = {.numQubits = -1};
+
+int getNumTuningThreads() {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+void applyUncontrolled(qreal* amps, INDEX numAmps) {
+    INDEX i;
+    #pragma omp parallel for shared(amps,numAmps) private(i) schedule(static)
+    for (i=0; i<numAmps; i++)
+        amps[i] = f(amps[i]);
+}
+
+ControlTuning calibrateControlTuning(int numQubits, int numReps) {
+    
+    ControlTuning tuning;
+    tuning.numQubits = numQubits;
+    tuning.numThreads = getNumTuningThreads();
+    
+    INDEX numAmps = pow2(numQubits);
+    qreal* amps = malloc(numAmps * sizeof *amps);
+    initArray(amps, numAmps);
+    
+    // every call is upon a freshly initialised array, else f drives the 
+    // amplitudes to inf within a dozen calls
+    HarnessConfig cfg = {.numWarmups = 0, .numReps = numReps};
+    HarnessStats stats;
+    
+    // single control: compare each method's mean duration over the reps
+    for (int c=0; c<numQubits; c++) {
+        double bestDur = -1;
+        for (int m=0; m<NUM_S_METHODS; m++) {
+            HARNESS_RUN(cfg, stats, 
+                initArray(amps, numAmps), 
+                s_methods[m](amps, numAmps, c));
+            if (bestDur < 0 || stats.mean < bestDur) {
+                bestDur = stats.mean;
+                tuning.s_best[c] = m;
+            }
+        }
+    }
+    
+    // many controls: every method tries the same random controls
+    tuning.m_best[0] = DEFAULT_M_METHOD;
+    tuning.m_best[1] = DEFAULT_M_METHOD;
+    for (int numCtrls=2; numCtrls<=numQubits; numCtrls++) {
+        int ctrls[numReps][numCtrls];
+        for (int r=0; r<numReps; r++)
+            getSortedRandomSubReg(ctrls[r], numCtrls, numQubits);
+        
+        double bestDur = -1;
+        for (int m=0; m<NUM_M_METHODS; m++) {
+            HARNESS_RUN(cfg, stats, 
+                initArray(amps, numAmps), 
+                m_methods[m](amps, numAmps, ctrls[harnessRep], numCtrls));
+            if (bestDur < 0 || stats.mean < bestDur) {
+                bestDur = stats.mean;
+                tuning.m_best[numCtrls] = m;
+            }
+        }
+    }
+    
+    free(amps);
+    return tuning;
+}
+
+int getMethodIndex(char** names, int numNames, char* name) {
+    for (int m=0; m<numNames; m++)
+        if (strcmp(names[m], name) == 0)
+            return m;
+    return -1;
+}
+
+/* a profile holds one line per tuning, formatted as
+ *      numQubits numThreads  s_best[0] ... s_best[numQubits-1]  m_best[2] ... m_best[numQubits]
+ * where every method is given by its name
+ */
+
+void saveControlTuning(ControlTuning* tuning, char* profileFN) {
+    
+    // append, so that a profile can hold tunings for several sizes and thread counts
+    FILE* file = fopen(profileFN, "a");
+    if (file == NULL) {
+        printf("could not write tuning profile %s\n", profileFN);
+        return;
+    }
+    fprintf(file, "%d %d ", tuning->numQubits, tuning->numThreads);
+    for (int c=0; c<tuning->numQubits; c++)
+        fprintf(file, " %s", s_methodNames[tuning->s_best[c]]);
+    fprintf(file, " ");
+    for (int n=2; n<=tuning->numQubits; n++)
+        fprintf(file, " %s", m_methodNames[tuning->m_best[n]]);
+    fprintf(file, "\n");
+    fclose(file);
+}
+
+int loadControlTuning(ControlTuning* tuning, int numQubits, int numThreads, char* profileFN) {
+    
+    // returns 1 only if profileFN contains a fully valid tuning for this case
+    FILE* file = fopen(profileFN, "r");
+    if (file == NULL)
+        return 0;
+    
+    int found = 0;
+    int fileQubits, fileThreads;
+    char name[50];
+    
+    while (!found && fscanf(file, "%d %d", &fileQubits, &fileThreads) == 2) {
+        int match = (fileQubits == numQubits && fileThreads == numThreads);
+        int valid = (fileQubits > 0 && fileQubits <= TUNING_MAX_QUBITS);
+        
+        // read the full line, even when skipping it
+        for (int c=0; valid && c<fileQubits; c++) {
+            valid = (fscanf(file, "%49s", name) == 1);
+            if (valid && match)
+                valid = (tuning->s_best[c] = getMethodIndex(s_methodNames, NUM_S_METHODS, name)) >= 0;
+        }
+        for (int n=2; valid && n<=fileQubits; n++) {
+            valid = (fscanf(file, "%49s", name) == 1);
+            if (valid && match)
+                valid = (tuning->m_best[n] = getMethodIndex(m_methodNames, NUM_M_METHODS, name)) >= 0;
+        }
+        if (!valid)
+            break;
+        found = match;
+    }
+    fclose(file);
+    
+    if (!found)
+        return 0;
+    
+    tuning->numQubits = numQubits;
+    tuning->numThreads = numThreads;
+    tuning->m_best[0] = DEFAULT_M_METHOD;
+    tuning->m_best[1] = DEFAULT_M_METHOD;
+    return 1;
+}
+
+void initControlTuning(int numQubits, int numReps, char* profileFN) {
+    
+    // loads the tuning from profileFN if present, else calibrates and saves it
+    int numThreads = getNumTuningThreads();
+    if (loadControlTuning(&activeTuning, numQubits, numThreads, profileFN))
+        return;
+    
+    activeTuning = calibrateControlTuning(numQubits, numReps);
+    saveControlTuning(&activeTuning, profileFN);
+}
+
+void applyControlled(qreal* amps, INDEX numAmps, int* ctrls, int numCtrls) {
+    
+    // ctrls must be increasing; dispatches to the best method of the active tuning
+    int numQubits = __builtin_ctzll(numAmps);
+    int isTuned = (
+        activeTuning.numQubits == numQubits && 
+        activeTuning.numThreads == getNumTuningThreads());
+    
+    if (numCtrls == 0)
+        applyUncontrolled(amps, numAmps);
+    else if (numCtrls == 1)
+        s_methods[isTuned? activeTuning.s_best[ctrls[0]] : DEFAULT_S_METHOD](amps, numAmps, ctrls[0]);
+    else
+        m_methods[isTuned? activeTuning.m_best[numCtrls] : DEFAULT_M_METHOD](amps, numAmps, ctrls, numCtrls);
+}
+
+
+
+
+/* launch (omitted when this file is included by the distributed tests) */
+
+#ifndef EXCLUDE_MAIN
 
 void simpleTest() {
     
     int numQubits = 27;
     INDEX numAmps = (1LL << numQubits);
-    double* amps = malloc(numAmps * sizeof *amps);
+    qreal* amps = malloc(numAmps * sizeof *amps);
     printf("[%d qubits]\n\n", numQubits);
     
     initArray(amps, numAmps);
@@ -155,7 +701,7 @@ void simpleTest() {
 
     int c = 2;
     
-    for (int m=0; m<4; m++) {
+    for (int m=0; m<NUM_S_METHODS; m++) {
         
         printf("%s\n", s_methodNames[m]);
         
@@ -170,7 +716,7 @@ void simpleTest() {
     int numCtrls = 10;
     int ctrls[] = {0,2,4,6,7,15,16,20,21,22}; // must be increasing
     
-    for (int m=0; m<3; m++) {
+    for (int m=0; m<NUM_M_METHODS; m++) {
         
         printf("%s\n", m_methodNames[m]);
         
@@ -190,49 +736,36 @@ void s_benchmarking(int numQubits, int numReps, char* outFN) {
     
     int outPrec = 5;
     INDEX numAmps = (1LL << numQubits);
-    double* amps = malloc(numAmps * sizeof *amps);
+    qreal* amps = malloc(numAmps * sizeof *amps);
     printf("[%d qubits]\n\n", numQubits);
     
     // you MUST init array before benchmarking, because the very first write to 
     // heap memory has an overhead on some platforms! Funky!
     initArray(amps, numAmps);
     
-    double durs[4][numQubits];
-    double vars[4][numQubits];
+    // the passing half of the amplitudes are each read and written once
+    HarnessConfig cfg = {.numWarmups = 1, .numReps = numReps, .flushCache = 1, .countEvents = HARNESS_COUNT_EVENTS};
+    cfg.ampsPerRep = numAmps / 2;
+    cfg.bytesPerRep = 2 * sizeof *amps * cfg.ampsPerRep;
     
-    for (int m=0; m<4; m++) {
-        
-        for (int c=0; c<numQubits; c++) {
-            
-            double rawDurs[numReps];
-            
-            for (int r=0; r<numReps; r++) {
-                initArray(amps, numAmps);
-                
-                START_TIMING()
-                s_methods[m](amps, numAmps, c);
-                RECORD_TIMING(double dur);
-                
-                rawDurs[r] = dur;
-            }
-            
-            getAverageAndVariance(rawDurs, numReps, &durs[m][c], &vars[m][c]);
-        }
-    }
+    HarnessStats stats[NUM_S_METHODS][numQubits];
+    
+    for (int m=0; m<NUM_S_METHODS; m++)
+        for (int c=0; c<numQubits; c++)
+            HARNESS_RUN(cfg, stats[m][c], 
+                initArray(amps, numAmps), 
+                s_methods[m](amps, numAmps, c));
     
     
     FILE* file = openAssocWrite(outFN);
-    writeStringToAssoc(file, "note", "timings are already per-rep");
+    writeStringToAssoc(file, "precision", PRECISION_NAME);
+    writeStringToAssoc(file, "note", "timings are already per-rep; bw (GB/s) and rate (amps/s) count only passing amps");
     writeIntToAssoc(file, "numQubits", numQubits);
     writeIntToAssoc(file, "numReps", numReps);
+    writeIntToAssoc(file, "numWarmups", cfg.numWarmups);
     writeIntToAssoc(file, "outPrec", outPrec);
-    for (int m=0; m<4; m++) {
-        char buff[50];
-        strcpy(buff, "dur_"); strcat(buff, s_methodNames[m]);
-        writeDoubleArrToAssoc(file, buff, durs[m], numQubits, outPrec);
-        strcpy(buff, "var_"); strcat(buff, s_methodNames[m]);
-        writeDoubleArrToAssoc(file, buff, vars[m], numQubits, outPrec);
-    }
+    for (int m=0; m<NUM_S_METHODS; m++)
+        writeHarnessStatsArrToAssoc(file, s_methodNames[m], stats[m], numQubits, outPrec);
     closeAssocWrite(file);
     
     free(amps);
@@ -246,7 +779,7 @@ void m_benchmarking(int numQubits, int numReps, char* outFN) {
     
     int outPrec = 10;
     INDEX numAmps = (1LL << numQubits);
-    double* amps = malloc(numAmps * sizeof *amps);
+    qreal* amps = malloc(numAmps * sizeof *amps);
     printf("[%d qubits]\n\n", numQubits);
     
     // you MUST init array before benchmarking, because the very first write to 
@@ -260,63 +793,286 @@ void m_benchmarking(int numQubits, int numReps, char* outFN) {
      * is trying the identical controls assignments too, so we don't have to worry about 
      * sampling thresholds.
      */
+    
+    HarnessConfig cfg = {.numWarmups = 1, .numReps = numReps, .flushCache = 1, .countEvents = HARNESS_COUNT_EVENTS};
+    int numCalls = cfg.numWarmups + cfg.numReps;
      
-    double durs[3][numQubits+1];
-    double vars[3][numQubits+1];
-    for (int m=0; m<3; m++) {
-        for (int i=0; i<(numQubits+1); i++) {
-            durs[m][i] = -1;
-            vars[m][i] = -1;
-        }
-    }
+    HarnessStats stats[NUM_M_METHODS][numQubits+1];
+    for (int m=0; m<NUM_M_METHODS; m++)
+        for (int i=0; i<(numQubits+1); i++)
+            stats[m][i] = getEmptyHarnessStats();
 
     
     // try every possible #numCtrls
     for (int numCtrls=2; numCtrls<=numQubits; numCtrls++) {
-        int ctrls[numCtrls];
         
-        // obtain data
-        double rawDurs[3][numReps];
+        // every call (including warm-ups) gets new controls, shared by all methods
+        int ctrls[numCalls][numCtrls];
+        for (int r=0; r<numCalls; r++)
+            getSortedRandomSubReg(ctrls[r], numCtrls, numQubits);
+        
+        // the passing amplitudes are each read and written once
+        cfg.ampsPerRep = numAmps >> numCtrls;
+        cfg.bytesPerRep = 2 * sizeof *amps * cfg.ampsPerRep;
         
-        for (int r=0; r<numReps; r++) {            
-            getSortedRandomSubReg(ctrls, numCtrls, numQubits);
+        for (int m=0; m<NUM_M_METHODS; m++)
+            HARNESS_RUN(cfg, stats[m][numCtrls], 
+                initArray(amps, numAmps), 
+                m_methods[m](amps, numAmps, ctrls[harnessRep], numCtrls));
+    }
+    
+    
+    FILE* file = openAssocWrite(outFN);
+    writeStringToAssoc(file, "precision", PRECISION_NAME);
+    writeStringToAssoc(file, "note", "timings are already per-rep; bw (GB/s) and rate (amps/s) count only passing amps");
+    writeIntToAssoc(file, "numQubits", numQubits);
+    writeIntToAssoc(file, "numReps", numReps);
+    writeIntToAssoc(file, "numWarmups", cfg.numWarmups);
+    writeIntToAssoc(file, "outPrec", outPrec);
+    for (int m=0; m<NUM_M_METHODS; m++)
+        writeHarnessStatsArrToAssoc(file, m_methodNames[m], stats[m], numQubits+1, outPrec);
+    closeAssocWrite(file);
+    
+    
+    free(amps);
+}
+
+
+void getBenchmarkUnitary(amp* u) {
+    
+    // an arbitrary (non-diagonal, complex) rotation, which keeps the state normalised
+    double theta = .3;
+    amp phase = expI(.7);
+    u[0] = cos(theta);  u[1] = - phase * sin(theta);
+    u[2] = sin(theta);  u[3] = phase * cos(theta);
+}
+
+void us_benchmarking(int numQubits, int t, int numReps, char* outFN) {
+    
+    int outPrec = 5;
+    INDEX numAmps = (1LL << numQubits);
+    amp* psi = createStatevector(numQubits);
+    printf("[%d qubits, target %d]\n\n", numQubits, t);
+    
+    // the unitary keeps the state bounded, so needs no reinitialisation
+    initSeededStatevector(psi, numQubits, 123456789);
+    amp u[4];
+    getBenchmarkUnitary(u);
+    
+    // the passing half of the amplitudes (a quarter of the pairs upon t) are each read and written once
+    HarnessConfig cfg = {.numWarmups = 1, .numReps = numReps, .flushCache = 1, .countEvents = HARNESS_COUNT_EVENTS};
+    cfg.ampsPerRep = numAmps / 2;
+    cfg.bytesPerRep = 2 * sizeof *psi * cfg.ampsPerRep;
+    
+    HarnessStats stats[NUM_U_METHODS][numQubits];
+    
+    for (int m=0; m<NUM_U_METHODS; m++)
+        for (int c=0; c<numQubits; c++) {
+            if (c == t) {
+                stats[m][c] = getEmptyHarnessStats();
+                continue;
+            }
+            HARNESS_RUN(cfg, stats[m][c], , 
+                u_methods[m](psi, numAmps, &c, 1, t, u));
+        }
+    
+    
+    FILE* file = openAssocWrite(outFN);
+    writeStringToAssoc(file, "precision", PRECISION_NAME);
+    writeStringToAssoc(file, "note", "timings are already per-rep; bw (GB/s) and rate (amps/s) count only passing amps; the target's own entry is -1");
+    writeIntToAssoc(file, "numQubits", numQubits);
+    writeIntToAssoc(file, "target", t);
+    writeIntToAssoc(file, "numReps", numReps);
+    writeIntToAssoc(file, "numWarmups", cfg.numWarmups);
+    writeIntToAssoc(file, "outPrec", outPrec);
+    for (int m=0; m<NUM_U_METHODS; m++)
+        writeHarnessStatsArrToAssoc(file, u_methodNames[m], stats[m], numQubits, outPrec);
+    closeAssocWrite(file);
+    
+    free(psi);
+}
+
+
+
+
+void um_benchmarking(int numQubits, int t, int numReps, char* outFN) {
+    
+    int outPrec = 10;
+    INDEX numAmps = (1LL << numQubits);
+    amp* psi = createStatevector(numQubits);
+    printf("[%d qubits, target %d]\n\n", numQubits, t);
+    
+    initSeededStatevector(psi, numQubits, 123456789);
+    amp u[4];
+    getBenchmarkUnitary(u);
+    
+    // as m_benchmarking, with new controls (excluding t) every call, shared by all methods
+    HarnessConfig cfg = {.numWarmups = 1, .numReps = numReps, .flushCache = 1, .countEvents = HARNESS_COUNT_EVENTS};
+    int numCalls = cfg.numWarmups + cfg.numReps;
+     
+    HarnessStats stats[NUM_U_METHODS][numQubits];
+    for (int m=0; m<NUM_U_METHODS; m++)
+        for (int i=0; i<numQubits; i++)
+            stats[m][i] = getEmptyHarnessStats();
+    
+    for (int numCtrls=2; numCtrls<numQubits; numCtrls++) {
+        
+        int ctrls[numCalls][numCtrls];
+        for (int r=0; r<numCalls; r++) {
+            getSortedRandomSubReg(ctrls[r], numCtrls, numQubits-1);
+            for (int n=0; n<numCtrls; n++)
+                ctrls[r][n] += (ctrls[r][n] >= t);
+        }
+        
+        // the passing pairs are each read and written once
+        cfg.ampsPerRep = numAmps >> numCtrls;
+        cfg.bytesPerRep = 2 * sizeof *psi * cfg.ampsPerRep;
+        
+        for (int m=0; m<NUM_U_METHODS; m++)
+            HARNESS_RUN(cfg, stats[m][numCtrls], , 
+                u_methods[m](psi, numAmps, ctrls[harnessRep], numCtrls, t, u));
+    }
+    
+    
+    FILE* file = openAssocWrite(outFN);
+    writeStringToAssoc(file, "precision", PRECISION_NAME);
+    writeStringToAssoc(file, "note", "timings are already per-rep; bw (GB/s) and rate (amps/s) count only passing amps");
+    writeIntToAssoc(file, "numQubits", numQubits);
+    writeIntToAssoc(file, "target", t);
+    writeIntToAssoc(file, "numReps", numReps);
+    writeIntToAssoc(file, "numWarmups", cfg.numWarmups);
+    writeIntToAssoc(file, "outPrec", outPrec);
+    for (int m=0; m<NUM_U_METHODS; m++)
+        writeHarnessStatsArrToAssoc(file, u_methodNames[m], stats[m], numQubits, outPrec);
+    closeAssocWrite(file);
+    
+    free(psi);
+}
+
+
+void writeRooflineArrToAssoc(FILE* file, char* prefix, char* name, double* arr, int len, int precision) {
+    char key[100];
+    sprintf(key, "%s_%s", prefix, name);
+    writeDoubleArrToAssoc(file, key, arr, len, precision);
+}
+
+void rooflineBenchmarking(int numQubits, int numReps, char* outFN) {
+    
+    int outPrec = 5;
+    INDEX numAmps = (1LL << numQubits);
+    qreal* amps = malloc(numAmps * sizeof *amps);
+    printf("[%d qubits]\n\n", numQubits);
+    
+    RooflinePeaks peaks = measureRooflinePeaks(numReps);
+    printRooflinePeaks(peaks);
+    
+    initArray(amps, numAmps);
+    HarnessConfig cfg = {.numWarmups = 1, .numReps = numReps, .flushCache = 1};
+    
+    /* single control: attainment (%) of the roofline bound, and of peak bandwidth,
+     * per method and control qubit
+     */
+    double s_att[NUM_S_METHODS][numQubits];
+    double s_bwAtt[NUM_S_METHODS][numQubits];
+    double s_gflops[NUM_S_METHODS][numQubits];
+    
+    for (int m=0; m<NUM_S_METHODS; m++) {
+        for (int c=0; c<numQubits; c++) {
+            double numBytes, numFlops;
+            getMethodCost(s_methodsAreDense[m], numAmps, &c, 1, &numBytes, &numFlops);
+            cfg.bytesPerRep = numBytes;
+            
+            HarnessStats stats;
+            HARNESS_RUN(cfg, stats, 
+                initArray(amps, numAmps), 
+                s_methods[m](amps, numAmps, c));
             
-            for (int m=0; m<3; m++) {                
-                initArray(amps, numAmps);    
-                            
-                START_TIMING();
-                m_methods[m](amps, numAmps, ctrls, numCtrls);
-                RECORD_TIMING(double dur);
-                
-                rawDurs[m][r] = dur;
+            s_att[m][c] = getRooflineAttainment(peaks, numBytes, numFlops, stats.median);
+            s_bwAtt[m][c] = 100 * stats.bandwidth / peaks.bandwidth;
+            s_gflops[m][c] = numFlops / stats.median / 1E9;
+        }
+    }
+    
+    /* many controls: as above, per number of controls, where the cost is 
+     * averaged over the random controls of the timed calls
+     */
+    int numCalls = cfg.numWarmups + cfg.numReps;
+    double m_att[NUM_M_METHODS][numQubits+1];
+    double m_bwAtt[NUM_M_METHODS][numQubits+1];
+    double m_gflops[NUM_M_METHODS][numQubits+1];
+    for (int m=0; m<NUM_M_METHODS; m++)
+        for (int i=0; i<(numQubits+1); i++)
+            m_att[m][i] = m_bwAtt[m][i] = m_gflops[m][i] = -1;
+    
+    for (int numCtrls=2; numCtrls<=numQubits; numCtrls++) {
+        int ctrls[numCalls][numCtrls];
+        for (int r=0; r<numCalls; r++)
+            getSortedRandomSubReg(ctrls[r], numCtrls, numQubits);
+        
+        for (int m=0; m<NUM_M_METHODS; m++) {
+            double numBytes = 0, numFlops = 0;
+            for (int r=cfg.numWarmups; r<numCalls; r++) {
+                double b, f;
+                getMethodCost(m_methodsAreDense[m], numAmps, ctrls[r], numCtrls, &b, &f);
+                numBytes += b / cfg.numReps;
+                numFlops += f / cfg.numReps;
             }
+            cfg.bytesPerRep = numBytes;
+            
+            HarnessStats stats;
+            HARNESS_RUN(cfg, stats, 
+                initArray(amps, numAmps), 
+                m_methods[m](amps, numAmps, ctrls[harnessRep], numCtrls));
+            
+            // the mean duration corresponds to the mean cost
+            m_att[m][numCtrls] = getRooflineAttainment(peaks, numBytes, numFlops, stats.mean);
+            m_bwAtt[m][numCtrls] = 100 * (numBytes / stats.mean / 1E9) / peaks.bandwidth;
+            m_gflops[m][numCtrls] = numFlops / stats.mean / 1E9;
         }
-                
-        // process data
-        for (int m=0; m<3; m++)
-            getAverageAndVariance(rawDurs[m], numReps, &durs[m][numCtrls], &vars[m][numCtrls]);
     }
     
     
     FILE* file = openAssocWrite(outFN);
-    writeStringToAssoc(file, "note", "timings are already per-rep");
+    writeStringToAssoc(file, "precision", PRECISION_NAME);
+    writeStringToAssoc(file, "note", "att is % of the roofline bound, bwAtt is % of peak bandwidth; s_ by control, m_ by number of controls");
     writeIntToAssoc(file, "numQubits", numQubits);
     writeIntToAssoc(file, "numReps", numReps);
     writeIntToAssoc(file, "outPrec", outPrec);
-    for (int m=0; m<3; m++) {
-        char buff[50];
-        strcpy(buff, "dur_"); strcat(buff, m_methodNames[m]);
-        writeDoubleArrToAssoc(file, buff, durs[m], numQubits+1, outPrec);
-        strcpy(buff, "var_"); strcat(buff, m_methodNames[m]);
-        writeDoubleArrToAssoc(file, buff, vars[m], numQubits+1, outPrec);
+    writeRooflinePeaksToAssoc(file, peaks, outPrec);
+    for (int m=0; m<NUM_S_METHODS; m++) {
+        writeRooflineArrToAssoc(file, "att_s", s_methodNames[m], s_att[m], numQubits, outPrec);
+        writeRooflineArrToAssoc(file, "bwAtt_s", s_methodNames[m], s_bwAtt[m], numQubits, outPrec);
+        writeRooflineArrToAssoc(file, "gflops_s", s_methodNames[m], s_gflops[m], numQubits, outPrec);
+    }
+    for (int m=0; m<NUM_M_METHODS; m++) {
+        writeRooflineArrToAssoc(file, "att_m", m_methodNames[m], m_att[m], numQubits+1, outPrec);
+        writeRooflineArrToAssoc(file, "bwAtt_m", m_methodNames[m], m_bwAtt[m], numQubits+1, outPrec);
+        writeRooflineArrToAssoc(file, "gflops_m", m_methodNames[m], m_gflops[m], numQubits+1, outPrec);
     }
     closeAssocWrite(file);
     
-    
     free(amps);
 }
 
 
+void tuningReport(int numQubits, int numReps, char* profileFN) {
+    
+    printf("[%d qubits, %d threads]\n\n", numQubits, getNumTuningThreads());
+    
+    START_TIMING()
+    initControlTuning(numQubits, numReps, profileFN);
+    STOP_TIMING()
+    
+    printf("single control (by control qubit):\n\t");
+    for (int c=0; c<numQubits; c++)
+        printf("%s ", s_methodNames[activeTuning.s_best[c]]);
+    printf("\nmany controls (by number of controls, from 2):\n\t");
+    for (int n=2; n<=numQubits; n++)
+        printf("%s ", m_methodNames[activeTuning.m_best[n]]);
+    printf("\n");
+}
+
+
 
 
 
@@ -340,9 +1096,33 @@ int main(int argc, char* argv[]) {
         int numReps = atoi(argv[3]);
         char* outFN = argv[4];
         m_benchmarking(numQubits, numReps, outFN);
+    
+    } else if (argc == 5 && argv[1][0] == 'r') {
+        int numQubits = atoi(argv[2]);
+        int numReps = atoi(argv[3]);
+        char* outFN = argv[4];
+        rooflineBenchmarking(numQubits, numReps, outFN);
+    
+    } else if (argc == 5 && argv[1][0] == 'a') {
+        int numQubits = atoi(argv[2]);
+        int numReps = atoi(argv[3]);
+        char* profileFN = argv[4];
+        tuningReport(numQubits, numReps, profileFN);
+        
+    } else if (argc == 6 && argv[1][0] == 'u' && (argv[1][1] == 's' || argv[1][1] == 'm')) {
+        int numQubits = atoi(argv[2]);
+        int target = atoi(argv[3]);
+        int numReps = atoi(argv[4]);
+        char* outFN = argv[5];
+        if (argv[1][1] == 's')
+            us_benchmarking(numQubits, target, numReps, outFN);
+        else
+            um_benchmarking(numQubits, target, numReps, outFN);
         
     } else
-        printf("call as either:\n\t./exec\n\t./exec [s/m] numQubits numReps outFN\n");
+        printf("call as either:\n\t./exec\n\t./exec [s/m/r] numQubits numReps outFN\n\t./exec [us/um] numQubits target numReps outFN\n\t./exec a numQubits numReps profileFN\n");
     
     return 0;
-}
\ No newline at end of file
+}
+
+#endif // EXCLUDE_MAIN
@@ -1,36 +1,62 @@
 
 /* Comparing the performance of local simulation of the QFT via 
  * a direct evaluation of the gates, vs one where contiguous 
- * controlled-phase gates have been merged into a single diagonal.
+ * controlled-phase gates have been merged into a single diagonal, vs
+ * a cache-blocked engine which fuses those merged stages into few passes,
+ * vs a general gate-fusion engine upon which either can be expressed.
+ * The trailing qubit reversal is performed by either swaps or a single
+ * permutation, or is deferred by relabelling the qubits.
  * Note that all operators (hadamards, swaps, phases) have been implemented
  * optimally, that is without branching or superfluous memory access.
- * This file does not include multithreading (yet!)
+ * All kernels are multithreaded, collapsing their nested loops so that every
+ * thread has work even when one loop (e.g. the outer loop when t = N-1) has
+ * a single iteration.
  *
  * It is important that inline functions are actually inlined, so pass optimisation
  * flags (especially with Clang)
  * run with:
- *      gcc local_qft.c -O1 -o test; ./test
+ *      gcc local_qft.c -O1 -lm -fopenmp -march=native -o test
+ *      ./test
+ *      ./test [t/v/n/r/b] numQubits numReps outFN
+ *      ./test e minQubits maxQubits outFN
+ * where t performs thread-scaling, v compares the SoA (vectorised) kernels 
+ * against the AoS kernels, n compares malloc'd statevectors against the 
+ * NUMA-aware (first-touched, huge-paged) allocations, with pinned threads, 
+ * r reports each kernel's attainment of the host's roofline, and b compares
+ * the throughput of transforming a batch of states one by one against the 
+ * batched (interleaved) QFT. Adding -DPRECISION=1 stores single-precision 
+ * amplitudes, and e reports the error of every QFT against a long double 
+ * reference, to quantify its cost.
  */
 
 #include "utilities.h"
+#include "mmaformatter.h"
+#include "soastatevector.h"
+#include "harness.h"
+#include "roofline.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 
 /* gates */
 
-void applyHadamard(amp* psi, int t, int N) {
+void applyGenericHadamard(amp* psi, int t, int N) {
     
-    const double fac = 1/sqrt(2);
+    const qreal fac = 1/sqrt(2);
     
-    const index jNum = pow2(N-(t+1));
-    const index kNum = pow2(t);
+    const INDEX jNum = pow2(N-(t+1));
+    const INDEX kNum = pow2(t);
     
-    for (index j=0; j<jNum; j++) {
-        for (index k=0; k<kNum; k++) {
+    #pragma omp parallel for schedule(static) collapse(2)
+    for (INDEX j=0; j<jNum; j++) {
+        for (INDEX k=0; k<kNum; k++) {
     
             // |j>|0>|k> and |j>|1>|k>
-            index j0k = getZeroBitFromAffix(j, k, t);
-            index j1k = flipBit(j0k, t);
+            INDEX j0k = getZeroBitFromAffix(j, k, t);
+            INDEX j1k = flipBit(j0k, t);
             
             amp a1 = psi[j0k];
             amp a2 = psi[j1k];
@@ -48,16 +74,17 @@ void applyControlledPhase(amp* psi, int c, int t, double theta, int N) {
     const amp fac = expI(theta);
     
     // phase shift |j>|1>|k>|1>|l>
-    const index jNum = pow2(N-(t2+1));
-    const index kNum = pow2(t2-(t1+1));
-    const index lNum = pow2(t1);
+    const INDEX jNum = pow2(N-(t2+1));
+    const INDEX kNum = pow2(t2-(t1+1));
+    const INDEX lNum = pow2(t1);
     
-    for (index j=0; j<jNum; j++) {
-        for (index k=0; k<kNum; k++) {
-            for (index l=0; l<lNum; l++) {
+    #pragma omp parallel for schedule(static) collapse(3)
+    for (INDEX j=0; j<jNum; j++) {
+        for (INDEX k=0; k<kNum; k++) {
+            for (INDEX l=0; l<lNum; l++) {
                 
-                index j0k0l = getZeroBitsFromAffixes(j, k, l, t2, t1);
-                index j1k1l = flipBit(flipBit(j0k0l, t2), t1);
+                INDEX j0k0l = getZeroBitsFromAffixes(j, k, l, t2, t1);
+                INDEX j1k1l = flipBit(flipBit(j0k0l, t2), t1);
                 
                 psi[j1k1l] *= fac;
             }
@@ -65,7 +92,7 @@ void applyControlledPhase(amp* psi, int c, int t, double theta, int N) {
     } 
 }
 
-void applySwap(amp* psi, int t1, int t2, int N) {
+void applyGenericSwap(amp* psi, int t1, int t2, int N) {
     if (t1 > t2) {
         int t = t1;
         t1 = t2;
@@ -73,17 +100,18 @@ void applySwap(amp* psi, int t1, int t2, int N) {
     }
     
     // |j>|0>|k>|1>|l> <-> |j>|1>|k>|0>|l>
-    const index jNum = pow2(N-(t2+1));
-    const index kNum = pow2(t2-(t1+1));
-    const index lNum = pow2(t1);
+    const INDEX jNum = pow2(N-(t2+1));
+    const INDEX kNum = pow2(t2-(t1+1));
+    const INDEX lNum = pow2(t1);
     
-    for (index j=0; j<jNum; j++) {
-        for (index k=0; k<kNum; k++) {
-            for (index l=0; l<lNum; l++) {
+    #pragma omp parallel for schedule(static) collapse(3)
+    for (INDEX j=0; j<jNum; j++) {
+        for (INDEX k=0; k<kNum; k++) {
+            for (INDEX l=0; l<lNum; l++) {
                 
-                index j0k0l = getZeroBitsFromAffixes(j, k, l, t2, t1);
-                index j0k1l = flipBit(j0k0l, t1);
-                index j1k0l = flipBit(j0k0l, t2);
+                INDEX j0k0l = getZeroBitsFromAffixes(j, k, l, t2, t1);
+                INDEX j0k1l = flipBit(j0k0l, t1);
+                INDEX j1k0l = flipBit(j0k0l, t2);
 
                 amp tmp = psi[j0k1l];
                 psi[j0k1l] = psi[j1k0l];
@@ -95,6 +123,107 @@ void applySwap(amp* psi, int t1, int t2, int N) {
 
 
 
+/* target-specialised gates */
+
+/* For small t, the inner loops of the Hadamard and swap have a tiny trip count 
+ * (2^t) known only at runtime, so cannot be unrolled or vectorised. We instead 
+ * compile a copy of each kernel for every (lower) target below 
+ * NUM_SPECIALISED_TARGETS, in which the inner loop is constant, and parallelise 
+ * only the long outer loops. These are chosen from a dispatch table, falling 
+ * back to the generic kernels above for larger targets. Each copy must contain 
+ * its own parallel region, since OpenMP outlines a region once, where t would
+ * again be a runtime variable; the inlined helpers below are hence serial.
+ */
+
+#define NUM_SPECIALISED_TARGETS 8
+
+FORCE_INLINE void applyLowHadamardBlock(amp* psi, INDEX j, const int t, const qreal fac) {
+    
+    for (INDEX k=0; k<pow2(t); k++) {
+        INDEX j0k = getZeroBitFromAffix(j, k, t);
+        INDEX j1k = flipBit(j0k, t);
+        
+        amp a1 = psi[j0k];
+        amp a2 = psi[j1k];
+        
+        psi[j0k] = fac*a1 + fac*a2;
+        psi[j1k] = fac*a1 - fac*a2;
+    }
+}
+
+FORCE_INLINE void applyLowSwapBlock(amp* psi, INDEX j, INDEX k, const int t1, int t2) {
+    
+    // t1 < t2
+    for (INDEX l=0; l<pow2(t1); l++) {
+        INDEX j0k0l = getZeroBitsFromAffixes(j, k, l, t2, t1);
+        INDEX j0k1l = flipBit(j0k0l, t1);
+        INDEX j1k0l = flipBit(j0k0l, t2);
+
+        amp tmp = psi[j0k1l];
+        psi[j0k1l] = psi[j1k0l];
+        psi[j1k0l] = tmp;
+    }
+}
+
+#define DEFINE_SPECIALISED_GATES(T) \
+    void applyHadamardT##T(amp* psi, int N) { \
+        const qreal fac = 1/sqrt(2); \
+        const INDEX jNum = pow2(N-(T+1)); \
+        _Pragma("omp parallel for schedule(static)") \
+        for (INDEX j=0; j<jNum; j++) \
+            applyLowHadamardBlock(psi, j, T, fac); \
+    } \
+    void applySwapT##T(amp* psi, int t2, int N) { \
+        const INDEX jNum = pow2(N-(t2+1)); \
+        const INDEX kNum = pow2(t2-(T+1)); \
+        _Pragma("omp parallel for schedule(static) collapse(2)") \
+        for (INDEX j=0; j<jNum; j++) \
+            for (INDEX k=0; k<kNum; k++) \
+                applyLowSwapBlock(psi, j, k, T, t2); \
+    }
+
+DEFINE_SPECIALISED_GATES(0)
+DEFINE_SPECIALISED_GATES(1)
+DEFINE_SPECIALISED_GATES(2)
+DEFINE_SPECIALISED_GATES(3)
+DEFINE_SPECIALISED_GATES(4)
+DEFINE_SPECIALISED_GATES(5)
+DEFINE_SPECIALISED_GATES(6)
+DEFINE_SPECIALISED_GATES(7)
+
+void (*hadamardKernels[NUM_SPECIALISED_TARGETS]) (amp* psi, int N) = {
+    applyHadamardT0, applyHadamardT1, applyHadamardT2, applyHadamardT3,
+    applyHadamardT4, applyHadamardT5, applyHadamardT6, applyHadamardT7
+};
+
+void (*swapKernels[NUM_SPECIALISED_TARGETS]) (amp* psi, int t2, int N) = {
+    applySwapT0, applySwapT1, applySwapT2, applySwapT3,
+    applySwapT4, applySwapT5, applySwapT6, applySwapT7
+};
+
+void applyHadamard(amp* psi, int t, int N) {
+    
+    if (t < NUM_SPECIALISED_TARGETS)
+        hadamardKernels[t](psi, N);
+    else
+        applyGenericHadamard(psi, t, N);
+}
+
+void applySwap(amp* psi, int t1, int t2, int N) {
+    if (t1 > t2) {
+        int t = t1;
+        t1 = t2;
+        t2 = t;
+    }
+    
+    if (t1 < NUM_SPECIALISED_TARGETS)
+        swapKernels[t1](psi, t2, N);
+    else
+        applyGenericSwap(psi, t1, t2, N);
+}
+
+
+
 /* QFT by circuit */
 
 void applyMultiplePhases(amp* psi, int tMax, int N) {
@@ -126,17 +255,18 @@ void applyQFTCircuit(amp* psi, int N) {
 void applyMergedPhases(amp* psi, int tMax, int N) {
 
     // |j>|1>|k>
-    const index jNum = pow2(N-(tMax+1));
-    const index kNum = pow2(tMax);
-    const index kMask = kNum-1;
+    const INDEX jNum = pow2(N-(tMax+1));
+    const INDEX kNum = pow2(tMax);
+    const INDEX kMask = kNum-1;
     
     const double fac = (M_PI / (double) kNum);
     
-    for (index j=0; j<jNum; j++) {
-        for (index k=0; k<kNum; k++) {
+    #pragma omp parallel for schedule(static) collapse(2)
+    for (INDEX j=0; j<jNum; j++) {
+        for (INDEX k=0; k<kNum; k++) {
             
-            index j0k = getZeroBitFromAffix(j, k, tMax);
-            index j1k = flipBit(j0k, tMax);
+            INDEX j0k = getZeroBitFromAffix(j, k, tMax);
+            INDEX j1k = flipBit(j0k, tMax);
             
             double theta = fac * (j1k & kMask);
             psi[j1k] *= expI(theta);
@@ -158,44 +288,1548 @@ void applyQFTAlgorithm(amp* psi, int N) {
 
 
 
-/* launch */
+/* phase table */
 
-int main() {
+/* The merged phases evaluate expI (a cos and sin) per amplitude per stage. Every
+ * such phase e^(i pi k/2^t) with t < numQubits is the root of unity 
+ * e^(i pi K/2^(numQubits-1)) where K = k 2^(numQubits-1-t), which we split as
+ * K = |hi>|lo> into the product of two precomputed tables, each of only 
+ * ~2^(numQubits/2) elements. A lookup hence costs a single complex multiply.
+ */
+
+typedef struct {
     
-    int N = 24;
-    amp* psi = createStatevector(N);
-    initRandomStatevector(psi, N);
-    printf("[%d qubits]\n\n", N);    
+    int numQubits;
+    int numLoBits;
+    amp* lo;
+    amp* hi;
     
-    printf("contiguous phases\n");
-    {
-        printf("\tas N gates\n");
-        START_TIMING()
-        applyMultiplePhases(psi, N-1, N);
-        STOP_TIMING()
+} PhaseTable;
+
+PhaseTable createPhaseTable(int N) {
+    
+    PhaseTable table;
+    table.numQubits = N;
+    table.numLoBits = (N-1)/2;
+    
+    const INDEX loNum = pow2(table.numLoBits);
+    const INDEX hiNum = pow2(N-1 - table.numLoBits);
+    const double fac = M_PI / (double) pow2(N-1);
+    
+    table.lo = malloc(loNum * sizeof *table.lo);
+    table.hi = malloc(hiNum * sizeof *table.hi);
+    for (INDEX l=0; l<loNum; l++)
+        table.lo[l] = expI(fac * l);
+    for (INDEX h=0; h<hiNum; h++)
+        table.hi[h] = expI(fac * (h << table.numLoBits));
+    
+    return table;
+}
+
+void destroyPhaseTable(PhaseTable* table) {
+    
+    free(table->lo);
+    free(table->hi);
+    table->numQubits = 0;
+}
+
+PhaseTable* getPhaseTable(int N) {
+    
+    // cached between calls, and only rebuilt if more qubits are needed 
+    // (which must not occur within a parallel region)
+    static PhaseTable cache = {0, 0, NULL, NULL};
+    if (cache.numQubits < N) {
+        destroyPhaseTable(&cache);
+        cache = createPhaseTable(N);
     }
-    {
-        printf("\tas 1 merged gate\n");
-        START_TIMING()
-        applyMergedPhases(psi, N-1, N);
-        STOP_TIMING()
+    return &cache;
+}
+
+FORCE_INLINE amp getPhaseFactor(PhaseTable* table, INDEX k, int t) {
+    
+    // e^(i pi k/2^t)
+    INDEX K = k << (table->numQubits-1 - t);
+    return table->hi[K >> table->numLoBits] * table->lo[truncateBits(K, table->numLoBits)];
+}
+
+void applyMergedPhasesTabled(amp* psi, int tMax, int N) {
+    
+    PhaseTable* table = getPhaseTable(N);
+
+    // |j>|1>|k>
+    const INDEX jNum = pow2(N-(tMax+1));
+    const INDEX kNum = pow2(tMax);
+    
+    #pragma omp parallel for schedule(static) collapse(2)
+    for (INDEX j=0; j<jNum; j++) {
+        for (INDEX k=0; k<kNum; k++) {
+            
+            INDEX j1k = flipBit(getZeroBitFromAffix(j, k, tMax), tMax);
+            psi[j1k] *= getPhaseFactor(table, k, tMax);
+        }
     }
+}
+
+void applyQFTAlgorithmTabled(amp* psi, int N) {
     
-    printf("QFT\n");
-    {
-        printf("\tusing full circuit\n");
-        START_TIMING()
-        applyQFTCircuit(psi, N);
-        STOP_TIMING()
+    for (int t=N-1; t>0; t--) {
+        applyHadamard(psi, t, N);
+        applyMergedPhasesTabled(psi, t, N);
     }
-    {   
-        printf("\tusing merged phases\n");
-        START_TIMING()
-        applyQFTAlgorithm(psi, N);
-        STOP_TIMING()
+    applyHadamard(psi, 0, N);
+    
+    for (int t=0; t<N/2; t++)
+        applySwap(psi, t, N-t-1, N);
+}
+
+
+
+/* bit reversal */
+
+/* Reverses the order of all N qubits (equivalent to the N/2 swaps which end the 
+ * QFT) in a single pass. The index |a>|m>|c>, where a and c are tiles of 
+ * BIT_REVERSAL_TILE_QUBITS bits, maps to |rev c>|rev m>|rev a>, so that the 
+ * 2^b x 2^b tiles of rows (a) of contiguous columns (c) at m and rev m are 
+ * exchanged in transpose through a cache-resident copy. Every cache line is 
+ * hence read and written once.
+ */
+
+#define BIT_REVERSAL_TILE_QUBITS 5
+
+void applyBitReversal(amp* psi, int N) {
+    
+    const int b = BIT_REVERSAL_TILE_QUBITS;
+    
+    // too few qubits to tile
+    if (N < 2*b) {
+        for (INDEX i=0; i<pow2(N); i++) {
+            INDEX j = reverseBits(i, N);
+            if (i < j) {
+                amp tmp = psi[i];
+                psi[i] = psi[j];
+                psi[j] = tmp;
+            }
+        }
+        return;
+    }
+    
+    const INDEX tNum = pow2(b);
+    const INDEX mNum = pow2(N-2*b);
+    const int aShift = N-b;
+    
+    INDEX rev[tNum];
+    for (INDEX c=0; c<tNum; c++)
+        rev[c] = reverseBits(c, b);
+    
+    INDEX m;
+    #pragma omp parallel for shared(psi,rev) private(m) schedule(static)
+    for (m=0; m<mNum; m++) {
+        INDEX mRev = reverseBits(m, N-2*b);
+        if (mRev < m)
+            continue;
+        
+        amp tileM[tNum][tNum];
+        amp tileR[tNum][tNum];
+        
+        for (INDEX a=0; a<tNum; a++)
+            for (INDEX c=0; c<tNum; c++) {
+                tileM[a][c] = psi[(a << aShift) | (m    << b) | c];
+                tileR[a][c] = psi[(a << aShift) | (mRev << b) | c];
+            }
+        
+        // element (a,c) of tile m becomes element (rev c, rev a) of tile mRev
+        for (INDEX a=0; a<tNum; a++)
+            for (INDEX c=0; c<tNum; c++) {
+                psi[(a << aShift) | (mRev << b) | c] = tileM[rev[c]][rev[a]];
+                psi[(a << aShift) | (m    << b) | c] = tileR[rev[c]][rev[a]];
+            }
     }
+}
+
+
+
+/* lazy qubit relabelling */
+
+/* qubitMap[q] is the physical qubit which currently stores logical qubit q, so 
+ * that swaps can be performed by relabelling alone. Gates upon logical qubits 
+ * resolve their physical targets through the map, and the physical order is 
+ * only restored (if ever) upon request, by realiseQubitMap.
+ */
+
+void initQubitMap(int* qubitMap, int N) {
     
+    for (int q=0; q<N; q++)
+        qubitMap[q] = q;
+}
 
-    free(psi);
-    return 0;
-}
\ No newline at end of file
+int isIdentityQubitMap(int* qubitMap, int N) {
+    
+    for (int q=0; q<N; q++)
+        if (qubitMap[q] != q)
+            return 0;
+    return 1;
+}
+
+void applyMappedHadamard(amp* psi, int* qubitMap, int t, int N) {
+    
+    applyHadamard(psi, qubitMap[t], N);
+}
+
+void applyMappedControlledPhase(amp* psi, int* qubitMap, int c, int t, double theta, int N) {
+    
+    applyControlledPhase(psi, qubitMap[c], qubitMap[t], theta, N);
+}
+
+void applyMappedSwap(int* qubitMap, int t1, int t2) {
+    
+    // no amplitudes move
+    int p = qubitMap[t1];
+    qubitMap[t1] = qubitMap[t2];
+    qubitMap[t2] = p;
+}
+
+int isReversedQubitMap(int* qubitMap, int N) {
+    
+    for (int q=0; q<N; q++)
+        if (qubitMap[q] != N-q-1)
+            return 0;
+    return 1;
+}
+
+void realiseQubitMap(amp* psi, int* qubitMap, int N) {
+    
+    // a full reversal (as left by the QFT) is performed in a single pass
+    if (N > 1 && isReversedQubitMap(qubitMap, N)) {
+        applyBitReversal(psi, N);
+        initQubitMap(qubitMap, N);
+        return;
+    }
+    
+    // else physically swap each logical qubit into place, one swap per transposition
+    for (int q=0; q<N; q++) {
+        int p = qubitMap[q];
+        if (p == q)
+            continue;
+        
+        // the logical qubit r currently resides in physical qubit q
+        int r = q;
+        while (qubitMap[r] != q)
+            r++;
+        
+        applySwap(psi, q, p, N);
+        qubitMap[r] = p;
+        qubitMap[q] = q;
+    }
+}
+
+void applyQFTAlgorithmPermuted(amp* psi, int* qubitMap, int N) {
+    
+    // the merged phases assume contiguous physical qubits
+    if (!isIdentityQubitMap(qubitMap, N))
+        realiseQubitMap(psi, qubitMap, N);
+    
+    for (int t=N-1; t>0; t--) {
+        applyHadamard(psi, t, N);
+        applyMergedPhases(psi, t, N);
+    }
+    applyHadamard(psi, 0, N);
+    
+    for (int t=0; t<N/2; t++)
+        applyMappedSwap(qubitMap, t, N-t-1);
+}
+
+
+
+/* QFT by algorithm, with bit reversal */
+
+void applyQFTAlgorithmBitReversal(amp* psi, int N) {
+    
+    for (int t=N-1; t>0; t--) {
+        applyHadamard(psi, t, N);
+        applyMergedPhases(psi, t, N);
+    }
+    applyHadamard(psi, 0, N);
+    
+    applyBitReversal(psi, N);
+}
+
+
+
+/* QFT by blocked algorithm */
+
+/* The merged algorithm above sweeps the full statevector twice per qubit. This
+ * engine instead fuses the Hadamard and merged phases of consecutive targets into
+ * single passes; a pass over QFT_GROUP_QUBITS high targets gathers the 2^group
+ * amplitudes differing in those bits (each a sequential stream in memory), while
+ * every target below QFT_TILE_QUBITS is processed entirely within cache-sized
+ * tiles. The merged phases are diagonal, so need only the amplitude index, and
+ * are looked up in the phase table.
+ */
+
+#define QFT_TILE_QUBITS 14
+#define QFT_GROUP_QUBITS 4
+
+void applyGroupedStages(amp* psi, int tHi, int tLo, int N) {
+
+    const qreal fac = 1/sqrt(2);
+    PhaseTable* table = getPhaseTable(N);
+
+    // |p>|g>|s> where g spans targets tLo..tHi
+    const INDEX pNum = pow2(N-(tHi+1));
+    const INDEX gNum = pow2(tHi-tLo+1);
+    const INDEX sNum = pow2(tLo);
+
+    #pragma omp parallel for schedule(static) collapse(2)
+    for (INDEX p=0; p<pNum; p++) {
+        for (INDEX s=0; s<sNum; s++) {
+
+            amp v[gNum];
+            INDEX pgs = (p << (tHi+1)) | s;
+            for (INDEX g=0; g<gNum; g++)
+                v[g] = psi[pgs | (g << tLo)];
+
+            for (int t=tHi; t>=tLo; t--) {
+                int b = t-tLo;
+
+                // Hadamard upon bit b of g
+                for (INDEX m=0; m<gNum/2; m++) {
+                    INDEX g0 = insertZeroBit(m, b);
+                    INDEX g1 = flipBit(g0, b);
+                    amp a1 = v[g0];
+                    amp a2 = v[g1];
+                    v[g0] = fac*a1 + fac*a2;
+                    v[g1] = fac*a1 - fac*a2;
+                }
+
+                // merged phases, where the index below t is |g below b>|s>
+                for (INDEX m=0; m<gNum/2; m++) {
+                    INDEX g1 = flipBit(insertZeroBit(m, b), b);
+                    INDEX k = (truncateBits(g1, b) << tLo) | s;
+                    v[g1] *= getPhaseFactor(table, k, t);
+                }
+            }
+
+            for (INDEX g=0; g<gNum; g++)
+                psi[pgs | (g << tLo)] = v[g];
+        }
+    }
+}
+
+void applyTiledStages(amp* psi, int B, int N) {
+
+    // every target below B (with its phases) is confined to a tile of 2^B amps
+    const INDEX tileSize = pow2(B);
+    
+    // build the phase table before any thread needs it
+    getPhaseTable(N);
+
+    #pragma omp parallel for schedule(static)
+    for (INDEX tile=0; tile<pow2(N); tile+=tileSize) {
+        for (int t=B-1; t>0; t--) {
+            applyHadamard(&psi[tile], t, B);
+            applyMergedPhasesTabled(&psi[tile], t, B);
+        }
+        applyHadamard(&psi[tile], 0, B);
+    }
+}
+
+int getNumBlockedQFTPasses(int N) {
+
+    // including the final bit reversal, a single pass
+    int B = (N < QFT_TILE_QUBITS)? N : QFT_TILE_QUBITS;
+    int numHigh = N - B;
+    return 2 + (numHigh + QFT_GROUP_QUBITS - 1) / QFT_GROUP_QUBITS;
+}
+
+void applyQFTBlocked(amp* psi, int N) {
+
+    int B = (N < QFT_TILE_QUBITS)? N : QFT_TILE_QUBITS;
+
+    for (int tHi=N-1; tHi>=B; tHi-=QFT_GROUP_QUBITS) {
+        int tLo = tHi - QFT_GROUP_QUBITS + 1;
+        if (tLo < B)
+            tLo = B;
+        applyGroupedStages(psi, tHi, tLo, N);
+    }
+    applyTiledStages(psi, B, N);
+    applyBitReversal(psi, N);
+}
+
+
+
+/* gate fusion */
+
+/* Gates are collected into a queue, which is then applied in as few passes over 
+ * the statevector as possible. Each pass fuses a run of consecutive gates whose 
+ * non-diagonal targets (of Hadamards, swaps and general 2x2 unitaries) number at
+ * most maxFusedQubits; it gathers the 2^k amplitudes spanned by those targets, 
+ * applies every gate of the run to them in turn, and scatters them back. Diagonal
+ * gates (controlled and merged phases) need only the amplitude index, so never
+ * add targets and always fuse.
+ */
+
+#define FUSION_MAX_QUBITS 4
+
+typedef enum {
+    GATE_HADAMARD, 
+    GATE_UNITARY, 
+    GATE_SWAP, 
+    GATE_CONTROLLED_PHASE, 
+    GATE_MERGED_PHASES
+} GateType;
+
+typedef struct {
+    
+    GateType type;
+    int targets[2];
+    double theta;
+    amp matrix[4];
+    
+} Gate;
+
+typedef struct {
+    
+    Gate* gates;
+    int numGates;
+    int capacity;
+    
+} GateQueue;
+
+GateQueue createGateQueue() {
+    
+    GateQueue queue;
+    queue.numGates = 0;
+    queue.capacity = 64;
+    queue.gates = malloc(queue.capacity * sizeof *queue.gates);
+    return queue;
+}
+
+void destroyGateQueue(GateQueue* queue) {
+    
+    free(queue->gates);
+    queue->numGates = 0;
+}
+
+void queueGate(GateQueue* queue, GateType type, int t1, int t2, double theta, amp* matrix) {
+    
+    if (queue->numGates == queue->capacity) {
+        queue->capacity *= 2;
+        queue->gates = realloc(queue->gates, queue->capacity * sizeof *queue->gates);
+    }
+    
+    Gate* gate = &queue->gates[queue->numGates++];
+    gate->type = type;
+    gate->targets[0] = t1;
+    gate->targets[1] = t2;
+    gate->theta = theta;
+    for (int i=0; i<4; i++)
+        gate->matrix[i] = (matrix == NULL)? 0 : matrix[i];
+}
+
+void queueHadamard(GateQueue* queue, int t) {
+    queueGate(queue, GATE_HADAMARD, t, t, 0, NULL);
+}
+
+void queueUnitary(GateQueue* queue, int t, amp* matrix) {
+    queueGate(queue, GATE_UNITARY, t, t, 0, matrix);
+}
+
+void queueSwap(GateQueue* queue, int t1, int t2) {
+    queueGate(queue, GATE_SWAP, t1, t2, 0, NULL);
+}
+
+void queueControlledPhase(GateQueue* queue, int c, int t, double theta) {
+    
+    // the phase factor is precomputed, as the first diagonal element
+    amp matrix[4] = {expI(theta), 0, 0, 1};
+    queueGate(queue, GATE_CONTROLLED_PHASE, c, t, theta, matrix);
+}
+
+void queueMergedPhases(GateQueue* queue, int tMax) {
+    queueGate(queue, GATE_MERGED_PHASES, tMax, tMax, 0, NULL);
+}
+
+INDEX getGateTargetMask(Gate* gate) {
+    
+    switch (gate->type) {
+        case GATE_HADAMARD:
+        case GATE_UNITARY:
+            return pow2(gate->targets[0]);
+        case GATE_SWAP:
+            return pow2(gate->targets[0]) | pow2(gate->targets[1]);
+        default:
+            return 0;
+    }
+}
+
+int getFusedPassEnd(GateQueue* queue, int start, int maxFusedQubits, INDEX* targetMask) {
+    
+    // returns the index of the first gate after the pass beginning at start
+    *targetMask = 0;
+    int end = start;
+    while (end < queue->numGates) {
+        INDEX mask = *targetMask | getGateTargetMask(&queue->gates[end]);
+        if (end > start && __builtin_popcountll(mask) > maxFusedQubits)
+            break;
+        *targetMask = mask;
+        end++;
+    }
+    return end;
+}
+
+int getNumFusedPasses(GateQueue* queue, int maxFusedQubits) {
+    
+    int numPasses = 0;
+    INDEX targetMask;
+    for (int start=0; start<queue->numGates; numPasses++)
+        start = getFusedPassEnd(queue, start, maxFusedQubits, &targetMask);
+    return numPasses;
+}
+
+FORCE_INLINE void applyFusedGate(Gate* gate, amp* v, INDEX gNum, INDEX* offsets, INDEX base, int* localBits, PhaseTable* table) {
+    
+    const qreal fac = 1/sqrt(2);
+    
+    switch (gate->type) {
+        
+        case GATE_HADAMARD:
+        case GATE_UNITARY: {
+            int b = localBits[gate->targets[0]];
+            amp m0 = fac, m1 = fac, m2 = fac, m3 = -fac;
+            if (gate->type == GATE_UNITARY) {
+                m0 = gate->matrix[0]; m1 = gate->matrix[1]; 
+                m2 = gate->matrix[2]; m3 = gate->matrix[3];
+            }
+            for (INDEX m=0; m<gNum/2; m++) {
+                INDEX g0 = insertZeroBit(m, b);
+                INDEX g1 = flipBit(g0, b);
+                amp a1 = v[g0];
+                amp a2 = v[g1];
+                v[g0] = m0*a1 + m1*a2;
+                v[g1] = m2*a1 + m3*a2;
+            }
+            break;
+        }
+        
+        case GATE_SWAP: {
+            int b1 = localBits[gate->targets[0]];
+            int b2 = localBits[gate->targets[1]];
+            for (INDEX g=0; g<gNum; g++) {
+                if (getBit(g, b1) == 1 && getBit(g, b2) == 0) {
+                    INDEX h = flipBit(flipBit(g, b1), b2);
+                    amp tmp = v[g];
+                    v[g] = v[h];
+                    v[h] = tmp;
+                }
+            }
+            break;
+        }
+        
+        case GATE_CONTROLLED_PHASE: {
+            INDEX mask = pow2(gate->targets[0]) | pow2(gate->targets[1]);
+            for (INDEX g=0; g<gNum; g++)
+                if (bitsAreAllOne(base | offsets[g], mask))
+                    v[g] *= gate->matrix[0];
+            break;
+        }
+        
+        case GATE_MERGED_PHASES: {
+            int t = gate->targets[0];
+            for (INDEX g=0; g<gNum; g++) {
+                INDEX i = base | offsets[g];
+                if (getBit(i, t))
+                    v[g] *= getPhaseFactor(table, truncateBits(i, t), t);
+            }
+            break;
+        }
+    }
+}
+
+void applyFusedPass(amp* psi, Gate* gates, int numGates, INDEX targetMask, int N) {
+    
+    PhaseTable* table = getPhaseTable(N);
+    
+    // the pass's targets, in increasing order, and their position in g
+    int numTargets = 0;
+    int targets[N];
+    int localBits[N];
+    for (int q=0; q<N; q++)
+        if (getBit(targetMask, q)) {
+            localBits[q] = numTargets;
+            targets[numTargets++] = q;
+        }
+    
+    // offsets[g] deposits the bits of g into the targets
+    const INDEX gNum = pow2(numTargets);
+    INDEX offsets[gNum];
+    for (INDEX g=0; g<gNum; g++) {
+        offsets[g] = 0;
+        for (int b=0; b<numTargets; b++)
+            offsets[g] |= (INDEX) getBit(g, b) << targets[b];
+    }
+    
+    const INDEX baseNum = pow2(N - numTargets);
+    
+    #pragma omp parallel for schedule(static)
+    for (INDEX m=0; m<baseNum; m++) {
+        
+        // base has a zero at every target
+        INDEX base = m;
+        for (int b=0; b<numTargets; b++)
+            base = insertZeroBit(base, targets[b]);
+        
+        amp v[gNum];
+        for (INDEX g=0; g<gNum; g++)
+            v[g] = psi[base | offsets[g]];
+        
+        for (int n=0; n<numGates; n++)
+            applyFusedGate(&gates[n], v, gNum, offsets, base, localBits, table);
+        
+        for (INDEX g=0; g<gNum; g++)
+            psi[base | offsets[g]] = v[g];
+    }
+}
+
+int applyGateQueue(amp* psi, GateQueue* queue, int maxFusedQubits, int N) {
+    
+    // returns the number of passes over the statevector
+    getPhaseTable(N);
+    
+    int numPasses = 0;
+    INDEX targetMask;
+    for (int start=0; start<queue->numGates; numPasses++) {
+        int end = getFusedPassEnd(queue, start, maxFusedQubits, &targetMask);
+        applyFusedPass(psi, &queue->gates[start], end-start, targetMask, N);
+        start = end;
+    }
+    return numPasses;
+}
+
+
+
+/* QFT by fused gates */
+
+void queueQFTCircuit(GateQueue* queue, int N) {
+    
+    for (int t=N-1; t>0; t--) {
+        queueHadamard(queue, t);
+        for (int c=t-1, m=2; c>=0; c--, m++)
+            queueControlledPhase(queue, t, c, 2 * M_PI / (double) pow2(m));
+    }
+    queueHadamard(queue, 0);
+    
+    for (int t=0; t<N/2; t++)
+        queueSwap(queue, t, N-t-1);
+}
+
+void queueQFTAlgorithm(GateQueue* queue, int N) {
+    
+    for (int t=N-1; t>0; t--) {
+        queueHadamard(queue, t);
+        queueMergedPhases(queue, t);
+    }
+    queueHadamard(queue, 0);
+    
+    for (int t=0; t<N/2; t++)
+        queueSwap(queue, t, N-t-1);
+}
+
+void applyQFTCircuitFused(amp* psi, int N) {
+    
+    GateQueue queue = createGateQueue();
+    queueQFTCircuit(&queue, N);
+    applyGateQueue(psi, &queue, FUSION_MAX_QUBITS, N);
+    destroyGateQueue(&queue);
+}
+
+void applyQFTAlgorithmFused(amp* psi, int N) {
+    
+    GateQueue queue = createGateQueue();
+    queueQFTAlgorithm(&queue, N);
+    applyGateQueue(psi, &queue, FUSION_MAX_QUBITS, N);
+    destroyGateQueue(&queue);
+}
+
+
+
+/* batched QFT */
+
+/* Many independent statevectors of N qubits, all transformed by the same 
+ * circuit, are stored interleaved in a batch-minor layout, where amplitude i 
+ * of state b is batch[i*B + b]. Every gate is then applied to the whole batch
+ * in one pass, each of whose iterations updates a contiguous row of B amps
+ * (vectorised over b), and every phase factor is found once per row rather 
+ * than once per state. B = 4 (or 8 in single precision) already fills a line.
+ */
+
+amp* createBatch(int N, int B) {
+    return malloc(pow2(N) * B * sizeof(amp));
+}
+
+void setBatchState(amp* batch, amp* psi, int b, int N, int B) {
+    for (INDEX i=0; i<pow2(N); i++)
+        batch[i*B + b] = psi[i];
+}
+
+void getBatchState(amp* psi, amp* batch, int b, int N, int B) {
+    for (INDEX i=0; i<pow2(N); i++)
+        psi[i] = batch[i*B + b];
+}
+
+void applyBatchedHadamard(amp* batch, int t, int N, int B) {
+    
+    const qreal fac = 1/sqrt(2);
+    
+    const INDEX jNum = pow2(N-(t+1));
+    const INDEX kNum = pow2(t);
+    
+    #pragma omp parallel for schedule(static) collapse(2)
+    for (INDEX j=0; j<jNum; j++) {
+        for (INDEX k=0; k<kNum; k++) {
+            
+            // the rows |j>|0>|k> and |j>|1>|k>, as 2B reals
+            INDEX j0k = getZeroBitFromAffix(j, k, t);
+            qreal* r0 = (qreal*) &batch[j0k * B];
+            qreal* r1 = (qreal*) &batch[flipBit(j0k, t) * B];
+            
+            #pragma omp simd
+            for (int b=0; b<2*B; b++) {
+                qreal a1 = r0[b];
+                qreal a2 = r1[b];
+                r0[b] = fac*a1 + fac*a2;
+                r1[b] = fac*a1 - fac*a2;
+            }
+        }
+    }
+}
+
+void applyBatchedMergedPhases(amp* batch, int tMax, int N, int B) {
+    
+    PhaseTable* table = getPhaseTable(N);
+    
+    // |j>|1>|k>
+    const INDEX jNum = pow2(N-(tMax+1));
+    const INDEX kNum = pow2(tMax);
+    
+    #pragma omp parallel for schedule(static) collapse(2)
+    for (INDEX j=0; j<jNum; j++) {
+        for (INDEX k=0; k<kNum; k++) {
+            
+            INDEX j1k = flipBit(getZeroBitFromAffix(j, k, tMax), tMax);
+            qreal* row = (qreal*) &batch[j1k * B];
+            
+            // one factor for the whole row, multiplied in real arithmetic so
+            // that the loop over the states vectorises
+            amp phase = getPhaseFactor(table, k, tMax);
+            qreal pr = creal(phase);
+            qreal pi = cimag(phase);
+            
+            #pragma omp simd
+            for (int b=0; b<B; b++) {
+                qreal re = row[2*b];
+                qreal im = row[2*b+1];
+                row[2*b]   = pr*re - pi*im;
+                row[2*b+1] = pr*im + pi*re;
+            }
+        }
+    }
+}
+
+void applyBatchedBitReversal(amp* batch, int N, int B) {
+    
+    // the rows are contiguous, so exchanging them whole needs no tiling
+    INDEX i;
+    #pragma omp parallel for shared(batch) private(i) schedule(static)
+    for (i=0; i<pow2(N); i++) {
+        INDEX j = reverseBits(i, N);
+        if (i < j)
+            for (int b=0; b<B; b++) {
+                amp tmp = batch[i*B + b];
+                batch[i*B + b] = batch[j*B + b];
+                batch[j*B + b] = tmp;
+            }
+    }
+}
+
+void applyBatchedQFT(amp* batch, int N, int B) {
+    
+    for (int t=N-1; t>0; t--) {
+        applyBatchedHadamard(batch, t, N, B);
+        applyBatchedMergedPhases(batch, t, N, B);
+    }
+    applyBatchedHadamard(batch, 0, N, B);
+    applyBatchedBitReversal(batch, N, B);
+}
+
+
+
+/* launch (omitted when this file is included by the distributed tests) */
+
+#ifndef EXCLUDE_MAIN
+
+HarnessConfig getSweepsConfig(HarnessConfig cfg, int numSweeps) {
+    
+    // a routine of numSweeps gates (or fused passes) moves numSweeps single sweeps
+    cfg.bytesPerRep *= numSweeps;
+    return cfg;
+}
+
+void simpleTest() {
+    
+    int N = 24;
+    amp* psi = createStatevector(N);
+    initSeededStatevector(psi, N, 123456789);
+    printf("[%d qubits]\n\n", N);    
+    
+    // each repetition keeps transforming psi; cfg's bandwidth is that of a single
+    // sweep, scaled by getSweepsConfig for routines of many gates
+    HarnessConfig cfg = {.numWarmups = 1, .numReps = 3, .flushCache = 0, .countEvents = HARNESS_COUNT_EVENTS};
+    cfg.ampsPerRep = pow2(N);
+    cfg.bytesPerRep = 2 * sizeof *psi * cfg.ampsPerRep;
+    HarnessStats stats;
+    
+    printf("contiguous phases\n");
+    {
+        printf("\tas N gates\n");
+        HARNESS_RUN(getSweepsConfig(cfg, N-1), stats, , applyMultiplePhases(psi, N-1, N));
+        printHarnessStats(stats);
+    }
+    {
+        printf("\tas 1 merged gate\n");
+        HARNESS_RUN(cfg, stats, , applyMergedPhases(psi, N-1, N));
+        printHarnessStats(stats);
+    }
+    {
+        printf("\tas 1 merged gate, with phase table\n");
+        getPhaseTable(N);
+        HARNESS_RUN(cfg, stats, , applyMergedPhasesTabled(psi, N-1, N));
+        printHarnessStats(stats);
+    }
+    
+    printf("QFT\n");
+    {
+        printf("\tusing full circuit\n");
+        HARNESS_RUN(getSweepsConfig(cfg, N + N*(N-1)/2 + N/2), stats, , applyQFTCircuit(psi, N));
+        printHarnessStats(stats);
+    }
+    {   
+        printf("\tusing merged phases\n");
+        HARNESS_RUN(getSweepsConfig(cfg, 2*N-1 + N/2), stats, , applyQFTAlgorithm(psi, N));
+        printHarnessStats(stats);
+    }
+    {   
+        printf("\tusing merged phases, with phase table\n");
+        HARNESS_RUN(getSweepsConfig(cfg, 2*N-1 + N/2), stats, , applyQFTAlgorithmTabled(psi, N));
+        printHarnessStats(stats);
+    }
+    {   
+        printf("\tusing merged phases, with bit reversal\n");
+        HARNESS_RUN(getSweepsConfig(cfg, 2*N), stats, , applyQFTAlgorithmBitReversal(psi, N));
+        printHarnessStats(stats);
+    }
+    
+    printf("final qubit reversal\n");
+    {
+        printf("\tas N/2 swaps\n");
+        HARNESS_RUN(getSweepsConfig(cfg, N/2), stats, , for (int t=0; t<N/2; t++) applySwap(psi, t, N-t-1, N));
+        printHarnessStats(stats);
+    }
+    {
+        printf("\tas 1 permutation\n");
+        HARNESS_RUN(cfg, stats, , applyBitReversal(psi, N));
+        printHarnessStats(stats);
+    }
+    
+    printf("QFT (continued)\n");
+    {
+        printf("\tusing blocked engine (%d passes, vs %d)\n", 
+            getNumBlockedQFTPasses(N), 2*N);
+        HARNESS_RUN(getSweepsConfig(cfg, getNumBlockedQFTPasses(N)), stats, , applyQFTBlocked(psi, N));
+        printHarnessStats(stats);
+    }
+    
+    {
+        printf("\tusing merged phases, with relabelled output\n");
+        int qubitMap[N];
+        {
+            HARNESS_RUN(getSweepsConfig(cfg, 2*N-1), stats, 
+                initQubitMap(qubitMap, N), 
+                applyQFTAlgorithmPermuted(psi, qubitMap, N));
+            printHarnessStats(stats);
+        }
+        printf("\t\tthen realising the relabelling\n");
+        {
+            // each repetition realises the reversal left by the permuted QFT
+            HARNESS_RUN(cfg, stats, 
+                for (int q=0; q<N; q++) qubitMap[q] = N-q-1, 
+                realiseQubitMap(psi, qubitMap, N));
+            printHarnessStats(stats);
+        }
+    }
+    
+    {
+        GateQueue queue = createGateQueue();
+        queueQFTCircuit(&queue, N);
+        int numPasses = getNumFusedPasses(&queue, FUSION_MAX_QUBITS);
+        printf("\tusing fused circuit gates (%d passes vs %d)\n", numPasses, queue.numGates);
+        destroyGateQueue(&queue);
+        
+        HARNESS_RUN(getSweepsConfig(cfg, numPasses), stats, , applyQFTCircuitFused(psi, N));
+        printHarnessStats(stats);
+    }
+    {
+        GateQueue queue = createGateQueue();
+        queueQFTAlgorithm(&queue, N);
+        int numPasses = getNumFusedPasses(&queue, FUSION_MAX_QUBITS);
+        printf("\tusing fused merged phases (%d passes vs %d)\n", numPasses, queue.numGates);
+        destroyGateQueue(&queue);
+        
+        HARNESS_RUN(getSweepsConfig(cfg, numPasses), stats, , applyQFTAlgorithmFused(psi, N));
+        printHarnessStats(stats);
+    }
+    
+    printf("max error vs merged phases\n");
+    {
+        amp* ref = createStatevector(N);
+        initSeededStatevector(psi, N, 123456789);
+        copyStatevector(ref, psi, N);
+        applyMergedPhases(ref, N-1, N);
+        applyMergedPhasesTabled(psi, N-1, N);
+        printf("\t1 merged gate, with phase table\n\t\t%g\n", getMaxAbsDifference(psi, ref, N));
+        
+        initSeededStatevector(psi, N, 123456789);
+        copyStatevector(ref, psi, N);
+        applyQFTAlgorithm(ref, N);
+        applyQFTAlgorithmTabled(psi, N);
+        printf("\tQFT, with phase table\n\t\t%g\n", getMaxAbsDifference(psi, ref, N));
+        
+        initSeededStatevector(psi, N, 123456789);
+        copyStatevector(ref, psi, N);
+        applyQFTAlgorithm(ref, N);
+        applyQFTBlocked(psi, N);
+        printf("\tQFT, with blocked engine\n\t\t%g\n", getMaxAbsDifference(psi, ref, N));
+        
+        initSeededStatevector(psi, N, 123456789);
+        copyStatevector(ref, psi, N);
+        applyQFTAlgorithm(ref, N);
+        applyQFTCircuitFused(psi, N);
+        printf("\tQFT, with fused circuit gates\n\t\t%g\n", getMaxAbsDifference(psi, ref, N));
+        
+        initSeededStatevector(psi, N, 123456789);
+        copyStatevector(ref, psi, N);
+        applyQFTAlgorithm(ref, N);
+        applyQFTAlgorithmFused(psi, N);
+        printf("\tQFT, with fused merged phases\n\t\t%g\n", getMaxAbsDifference(psi, ref, N));
+        free(ref);
+    }
+    
+
+    free(psi);
+}
+
+
+
+/* thread-scaling benchmark */
+
+#define NUM_SCALING_KERNELS 7
+char* scalingKernelNames[NUM_SCALING_KERNELS] = {"H", "P", "S", "M", "MT", "HG", "SG"};
+
+void applyScalingKernel(int kernel, amp* psi, int t, int N) {
+    
+    // two-qubit kernels pair t with its QFT swap partner
+    int p = (t == N-t-1)? (t+1)%N : N-t-1;
+    
+    switch (kernel) {
+        case 0: applyHadamard(psi, t, N); break;
+        case 1: applyControlledPhase(psi, t, p, M_PI/4, N); break;
+        case 2: applySwap(psi, t, p, N); break;
+        case 3: applyMergedPhases(psi, t, N); break;
+        case 4: applyMergedPhasesTabled(psi, t, N); break;
+        case 5: applyGenericHadamard(psi, t, N); break;
+        case 6: applyGenericSwap(psi, t, p, N); break;
+    }
+}
+
+/* the traffic and flops implied by each scaling kernel's access pattern, where
+ * only amplitudes which a kernel modifies are moved, in whole lines of 4
+ * amplitudes (8 in single precision), so that target bits below LINE_QUBITS skip no traffic
+ */
+
+#define LINE_QUBITS (PRECISION == 1? 3 : 2)
+#define FLOPS_PER_HADAMARD_PAIR 8   // two complex sums scaled by 1/sqrt(2)
+#define FLOPS_PER_PHASE 6           // one complex multiplication
+
+void getScalingKernelCost(int kernel, int t, int N, double* numBytes, double* numFlops) {
+    
+    int p = (t == N-t-1)? (t+1)%N : N-t-1;
+    double numAmps = pow2(N);
+    double numMoved = numAmps;
+    
+    switch (kernel) {
+        case 0: // every amplitude
+            *numFlops = FLOPS_PER_HADAMARD_PAIR * numAmps / 2;
+            break;
+        case 1: // amplitudes with both bits set
+            numMoved /= pow2((t >= LINE_QUBITS) + (p >= LINE_QUBITS));
+            *numFlops = FLOPS_PER_PHASE * numAmps / 4;
+            break;
+        case 2: // amplitudes with differing bits
+            if (t >= LINE_QUBITS && p >= LINE_QUBITS)
+                numMoved /= 2;
+            *numFlops = 0;
+            break;
+        case 4: // amplitudes with bit t set, excluding the table lookups
+            if (t >= LINE_QUBITS)
+                numMoved /= 2;
+            *numFlops = FLOPS_PER_PHASE * numAmps / 2;
+            break;
+    }
+    
+    *numBytes = 2 * sizeof(amp) * numMoved;
+}
+
+void threadBenchmarking(int numQubits, int numReps, char* outFN) {
+    
+    int outPrec = 5;
+    int N = numQubits;
+    amp* psi = createStatevector(N);
+    initSeededStatevector(psi, N, 123456789);
+    getPhaseTable(N);
+    
+    int maxThreads = 1;
+#ifdef _OPENMP
+    maxThreads = omp_get_max_threads();
+#endif
+    printf("[%d qubits, 1 to %d threads]\n\n", N, maxThreads);
+    
+    // durs[kernel][threads-1][target], flattened for writeNestedDoubleArrToAssoc
+    double* durs = malloc(NUM_SCALING_KERNELS * maxThreads * N * sizeof *durs);
+    double* vars = malloc(NUM_SCALING_KERNELS * maxThreads * N * sizeof *vars);
+    
+    for (int numThreads=1; numThreads<=maxThreads; numThreads++) {
+#ifdef _OPENMP
+        omp_set_num_threads(numThreads);
+#endif
+        for (int k=0; k<NUM_SCALING_KERNELS; k++) {
+            for (int t=0; t<N; t++) {
+                
+                double rawDurs[numReps];
+                for (int r=0; r<numReps; r++) {
+                    START_TIMING()
+                    applyScalingKernel(k, psi, t, N);
+                    RECORD_TIMING(double dur)
+                    rawDurs[r] = dur;
+                }
+                
+                int ind = (k*maxThreads + numThreads-1)*N + t;
+                getAverageAndVariance(rawDurs, numReps, &durs[ind], &vars[ind]);
+            }
+        }
+    }
+    
+    FILE* file = openAssocWrite(outFN);
+    writeStringToAssoc(file, "precision", PRECISION_NAME);
+    writeStringToAssoc(file, "note", "timings are already per-rep, indexed [numThreads][target]");
+    writeIntToAssoc(file, "numQubits", numQubits);
+    writeIntToAssoc(file, "numReps", numReps);
+    writeIntToAssoc(file, "maxThreads", maxThreads);
+    writeIntToAssoc(file, "outPrec", outPrec);
+    int lengths[2] = {maxThreads, N};
+    for (int k=0; k<NUM_SCALING_KERNELS; k++) {
+        char buff[50];
+        int offset = k*maxThreads*N;
+        strcpy(buff, "dur_"); strcat(buff, scalingKernelNames[k]);
+        writeNestedDoubleArrToAssoc(file, buff, &durs[offset], 2, lengths, N, outPrec);
+        strcpy(buff, "var_"); strcat(buff, scalingKernelNames[k]);
+        writeNestedDoubleArrToAssoc(file, buff, &vars[offset], 2, lengths, N, outPrec);
+    }
+    closeAssocWrite(file);
+    
+    free(durs);
+    free(vars);
+    free(psi);
+}
+
+
+
+/* AoS vs SoA benchmark */
+
+#define NUM_LAYOUT_KERNELS 4
+char* layoutKernelNames[NUM_LAYOUT_KERNELS] = {"H", "P", "S", "M"};
+
+void applySoAKernel(int kernel, SoAStatevector* psi, int t, int N) {
+    
+    // as per applyScalingKernel, where the merged phases use the phase table
+    int p = (t == N-t-1)? (t+1)%N : N-t-1;
+    
+    switch (kernel) {
+        case 0: applySoAHadamard(psi, t); break;
+        case 1: applySoAControlledPhase(psi, t, p, M_PI/4); break;
+        case 2: applySoASwap(psi, t, p); break;
+        case 3: applySoAMergedPhases(psi, t); break;
+    }
+}
+
+void layoutBenchmarking(int numQubits, int numReps, char* outFN) {
+    
+    int outPrec = 5;
+    int N = numQubits;
+    amp* psi = createStatevector(N);
+    initSeededStatevector(psi, N, 123456789);
+    SoAStatevector soa = createSoAStatevector(N);
+    copyAoSToSoA(&soa, psi);
+    getPhaseTable(N);
+    printf("[%d qubits, SIMD width %d]\n\n", N, SIMD_WIDTH);
+    
+    // AoS kernel indices in applyScalingKernel
+    int aosKernels[NUM_LAYOUT_KERNELS] = {0, 1, 2, 4};
+    
+    double durs[2][NUM_LAYOUT_KERNELS][N];
+    double vars[2][NUM_LAYOUT_KERNELS][N];
+    
+    for (int k=0; k<NUM_LAYOUT_KERNELS; k++) {
+        for (int t=0; t<N; t++) {
+            
+            double rawDurs[2][numReps];
+            for (int r=0; r<numReps; r++) {
+                {
+                    START_TIMING()
+                    applyScalingKernel(aosKernels[k], psi, t, N);
+                    RECORD_TIMING(rawDurs[0][r])
+                }
+                {
+                    START_TIMING()
+                    applySoAKernel(k, &soa, t, N);
+                    RECORD_TIMING(rawDurs[1][r])
+                }
+            }
+            
+            for (int l=0; l<2; l++)
+                getAverageAndVariance(rawDurs[l], numReps, &durs[l][k][t], &vars[l][k][t]);
+        }
+    }
+    
+    char* layoutNames[2] = {"AoS", "SoA"};
+    
+    FILE* file = openAssocWrite(outFN);
+    writeStringToAssoc(file, "precision", PRECISION_NAME);
+    writeStringToAssoc(file, "note", "timings are already per-rep, indexed by target");
+    writeIntToAssoc(file, "numQubits", numQubits);
+    writeIntToAssoc(file, "numReps", numReps);
+    writeIntToAssoc(file, "simdWidth", SIMD_WIDTH);
+    writeIntToAssoc(file, "outPrec", outPrec);
+    for (int l=0; l<2; l++) {
+        for (int k=0; k<NUM_LAYOUT_KERNELS; k++) {
+            char buff[50];
+            sprintf(buff, "dur_%s_%s", layoutNames[l], layoutKernelNames[k]);
+            writeDoubleArrToAssoc(file, buff, durs[l][k], N, outPrec);
+            sprintf(buff, "var_%s_%s", layoutNames[l], layoutKernelNames[k]);
+            writeDoubleArrToAssoc(file, buff, vars[l][k], N, outPrec);
+        }
+    }
+    closeAssocWrite(file);
+    
+    destroySoAStatevector(&soa);
+    free(psi);
+}
+
+
+
+/* NUMA allocation benchmark */
+
+#define NUM_ALLOC_KINDS 4
+char* allocKindNames[NUM_ALLOC_KINDS] = {"malloc", "touch", "thp", "huge"};
+
+#define NUM_NUMA_KERNELS 2
+char* numaKernelNames[NUM_NUMA_KERNELS] = {"H", "MT"};
+int numaKernels[NUM_NUMA_KERNELS] = {0, 4};
+
+amp* createBenchmarkStatevector(int kind, int N) {
+    
+    // the malloc kind is left untouched, to be first touched serially by its caller
+    switch (kind) {
+        case 1: return createNumaStatevector(N, PAGES_DEFAULT);
+        case 2: return createNumaStatevector(N, PAGES_TRANSPARENT_HUGE);
+        case 3: return createNumaStatevector(N, PAGES_HUGE_1GB);
+    }
+    return createStatevector(N);
+}
+
+void numaBenchmarking(int numQubits, int numReps, char* outFN) {
+    
+    int outPrec = 5;
+    int N = numQubits;
+    
+    // pinning must precede the first touch, and applies to every kind
+    int isPinned = pinThreads(1);
+    getPhaseTable(N);
+    printf("[%d qubits, %s threads]\n\n", N, isPinned? "pinned" : "unpinned");
+    
+    double durs[NUM_ALLOC_KINDS][NUM_NUMA_KERNELS][N];
+    double vars[NUM_ALLOC_KINDS][NUM_NUMA_KERNELS][N];
+    double bands[NUM_ALLOC_KINDS][NUM_NUMA_KERNELS][N];
+    
+    for (int a=0; a<NUM_ALLOC_KINDS; a++) {
+        // the malloc kind is first touched serially, so lies upon a single node
+        amp* psi = createBenchmarkStatevector(a, N);
+        if (a == 0)
+            initRandomStatevector(psi, N);
+        else
+            initSeededStatevector(psi, N, 123456789);
+        
+        for (int k=0; k<NUM_NUMA_KERNELS; k++) {
+            for (int t=0; t<N; t++) {
+                
+                double rawDurs[numReps];
+                for (int r=0; r<numReps; r++) {
+                    START_TIMING()
+                    applyScalingKernel(numaKernels[k], psi, t, N);
+                    RECORD_TIMING(rawDurs[r])
+                }
+                
+                // H moves every amplitude, but MT only those with bit t set
+                double numBytes, numFlops;
+                getScalingKernelCost(numaKernels[k], t, N, &numBytes, &numFlops);
+                getAverageAndVariance(rawDurs, numReps, &durs[a][k][t], &vars[a][k][t]);
+                bands[a][k][t] = numBytes / 1E9 / durs[a][k][t];
+            }
+            
+            printf("%s %s: %g GB/s at t=0\n", allocKindNames[a], numaKernelNames[k], bands[a][k][0]);
+        }
+        
+        if (a == 0)
+            free(psi);
+        else
+            destroyNumaStatevector(psi, N);
+    }
+    
+    FILE* file = openAssocWrite(outFN);
+    writeStringToAssoc(file, "precision", PRECISION_NAME);
+    writeStringToAssoc(file, "note", "timings are already per-rep, indexed by target; bandwidths are GB/s");
+    writeIntToAssoc(file, "numQubits", numQubits);
+    writeIntToAssoc(file, "numReps", numReps);
+    writeIntToAssoc(file, "isPinned", isPinned);
+    writeIntToAssoc(file, "outPrec", outPrec);
+    for (int a=0; a<NUM_ALLOC_KINDS; a++) {
+        for (int k=0; k<NUM_NUMA_KERNELS; k++) {
+            char buff[50];
+            sprintf(buff, "dur_%s_%s", allocKindNames[a], numaKernelNames[k]);
+            writeDoubleArrToAssoc(file, buff, durs[a][k], N, outPrec);
+            sprintf(buff, "var_%s_%s", allocKindNames[a], numaKernelNames[k]);
+            writeDoubleArrToAssoc(file, buff, vars[a][k], N, outPrec);
+            sprintf(buff, "bw_%s_%s", allocKindNames[a], numaKernelNames[k]);
+            writeDoubleArrToAssoc(file, buff, bands[a][k], N, outPrec);
+        }
+    }
+    closeAssocWrite(file);
+}
+
+
+
+/* roofline benchmark */
+
+#define NUM_ROOFLINE_KERNELS 4
+char* rooflineKernelNames[NUM_ROOFLINE_KERNELS] = {"H", "P", "S", "MT"};
+int rooflineKernels[NUM_ROOFLINE_KERNELS] = {0, 1, 2, 4};
+
+void rooflineBenchmarking(int numQubits, int numReps, char* outFN) {
+    
+    int outPrec = 5;
+    int N = numQubits;
+    amp* psi = createStatevector(N);
+    initSeededStatevector(psi, N, 123456789);
+    getPhaseTable(N);
+    printf("[%d qubits]\n\n", N);
+    
+    RooflinePeaks peaks = measureRooflinePeaks(numReps);
+    printRooflinePeaks(peaks);
+    
+    HarnessConfig cfg = {.numWarmups = 1, .numReps = numReps, .flushCache = 1};
+    double att[NUM_ROOFLINE_KERNELS][N];
+    double bwAtt[NUM_ROOFLINE_KERNELS][N];
+    double gflops[NUM_ROOFLINE_KERNELS][N];
+    
+    for (int k=0; k<NUM_ROOFLINE_KERNELS; k++) {
+        for (int t=0; t<N; t++) {
+            double numBytes, numFlops;
+            getScalingKernelCost(rooflineKernels[k], t, N, &numBytes, &numFlops);
+            cfg.bytesPerRep = numBytes;
+            
+            HarnessStats stats;
+            HARNESS_RUN(cfg, stats, , applyScalingKernel(rooflineKernels[k], psi, t, N));
+            
+            att[k][t] = getRooflineAttainment(peaks, numBytes, numFlops, stats.median);
+            bwAtt[k][t] = 100 * stats.bandwidth / peaks.bandwidth;
+            gflops[k][t] = numFlops / stats.median / 1E9;
+        }
+    }
+    
+    FILE* file = openAssocWrite(outFN);
+    writeStringToAssoc(file, "precision", PRECISION_NAME);
+    writeStringToAssoc(file, "note", "att is % of the roofline bound, bwAtt is % of peak bandwidth, indexed by target");
+    writeIntToAssoc(file, "numQubits", numQubits);
+    writeIntToAssoc(file, "numReps", numReps);
+    writeIntToAssoc(file, "outPrec", outPrec);
+    writeRooflinePeaksToAssoc(file, peaks, outPrec);
+    for (int k=0; k<NUM_ROOFLINE_KERNELS; k++) {
+        char buff[50];
+        sprintf(buff, "att_%s", rooflineKernelNames[k]);
+        writeDoubleArrToAssoc(file, buff, att[k], N, outPrec);
+        sprintf(buff, "bwAtt_%s", rooflineKernelNames[k]);
+        writeDoubleArrToAssoc(file, buff, bwAtt[k], N, outPrec);
+        sprintf(buff, "gflops_%s", rooflineKernelNames[k]);
+        writeDoubleArrToAssoc(file, buff, gflops[k], N, outPrec);
+    }
+    closeAssocWrite(file);
+    
+    free(psi);
+}
+
+
+
+/* batched benchmark */
+
+#define MAX_BATCH_SIZE 64
+#define MAX_BATCH_QUBITS 28     // of the whole batch, i.e. log2(numAmps * B)
+
+void batchBenchmarking(int numQubits, int numReps, char* outFN) {
+    
+    int outPrec = 5;
+    int N = numQubits;
+    getPhaseTable(N);
+    printf("[%d qubits]\n\n", N);
+    
+    // batch sizes double until the batch would exceed MAX_BATCH_QUBITS
+    int numSizes = 0;
+    int batchSizes[MAX_BATCH_SIZE];
+    for (int B=1; B<=MAX_BATCH_SIZE && N + log2(B) <= MAX_BATCH_QUBITS; B*=2)
+        batchSizes[numSizes++] = B;
+    
+    HarnessStats seqStats[numSizes];
+    HarnessStats batStats[numSizes];
+    double maxDiffs[numSizes];
+    
+    for (int s=0; s<numSizes; s++) {
+        int B = batchSizes[s];
+        
+        // the same B states, stored separately and interleaved
+        amp* states = malloc(pow2(N) * B * sizeof *states);
+        amp* batch = createBatch(N, B);
+        for (int b=0; b<B; b++) {
+            initSeededStatevector(&states[b * pow2(N)], N, 123456789 + b);
+            setBatchState(batch, &states[b * pow2(N)], b, N, B);
+        }
+        
+        // throughput (the rate key) is in states per second
+        HarnessConfig cfg = {.numWarmups = 1, .numReps = numReps, .flushCache = 1, .countEvents = HARNESS_COUNT_EVENTS};
+        cfg.ampsPerRep = B;
+        // N Hadamards, N-1 merged phases and the reversal each sweep the batch once
+        cfg.bytesPerRep = 2 * sizeof(amp) * pow2(N) * B * (2*N);
+        
+        HARNESS_RUN(cfg, seqStats[s], ,
+            for (int b=0; b<B; b++) applyQFTAlgorithmTabled(&states[b * pow2(N)], N));
+        HARNESS_RUN(cfg, batStats[s], , applyBatchedQFT(batch, N, B));
+        
+        // both have been transformed equally often, so should agree
+        amp* psi = createStatevector(N);
+        maxDiffs[s] = 0;
+        for (int b=0; b<B; b++) {
+            getBatchState(psi, batch, b, N, B);
+            double diff = getMaxAbsDifference(psi, &states[b * pow2(N)], N);
+            if (diff > maxDiffs[s])
+                maxDiffs[s] = diff;
+        }
+        free(psi);
+        
+        printf("B=%d: %.3g states/s sequentially, %.3g batched (max diff %g)\n",
+            B, seqStats[s].throughput, batStats[s].throughput, maxDiffs[s]);
+        free(states);
+        free(batch);
+    }
+    
+    FILE* file = openAssocWrite(outFN);
+    writeStringToAssoc(file, "precision", PRECISION_NAME);
+    writeStringToAssoc(file, "note", "timings are already per-rep and of the whole batch; rate is in states/s, indexed by batch size");
+    writeIntToAssoc(file, "numQubits", numQubits);
+    writeIntToAssoc(file, "numReps", numReps);
+    writeIntToAssoc(file, "outPrec", outPrec);
+    writeIntArrToAssoc(file, "batchSizes", batchSizes, numSizes);
+    writeDoubleArrToAssoc(file, "maxDiff", maxDiffs, numSizes, outPrec);
+    writeHarnessStatsArrToAssoc(file, "sequential", seqStats, numSizes, outPrec);
+    writeHarnessStatsArrToAssoc(file, "batched", batStats, numSizes, outPrec);
+    closeAssocWrite(file);
+}
+
+
+
+/* precision error */
+
+/* The QFT of a seeded state is compared against a reference computed in long
+ * double by a radix-2 FFT, from the same exact (double) initial amplitudes, so
+ * that the error of a single-precision build includes the rounding of its 
+ * input, and the error of a double build is resolved at all.
+ */
+
+#define NUM_ERROR_KERNELS 6
+void (*errorKernels[NUM_ERROR_KERNELS]) (amp* psi, int N) = {
+    applyQFTCircuit, applyQFTAlgorithm, applyQFTAlgorithmTabled, 
+    applyQFTAlgorithmBitReversal, applyQFTBlocked, applyQFTAlgorithmFused
+};
+char* errorKernelNames[NUM_ERROR_KERNELS] = {
+    "qftCircuit", "qftAlgorithm", "qftTabled", "qftBitReversal", "qftBlocked", "qftFused"
+};
+
+long double complex* getReferenceQFT(int N, uint64_t seed) {
+    
+    INDEX numAmps = pow2(N);
+    long double complex* ref = malloc(numAmps * sizeof *ref);
+    
+    // the seeded state, loaded in bit-reversed order for the in-place FFT
+    long double norm = 0;
+    for (INDEX i=0; i<numAmps; i++) {
+        uint32_t w[4];
+        getPhiloxWords(i, seed, w);
+        long double re = getDecimalFromWords(w[0], w[1]);
+        long double im = getDecimalFromWords(w[2], w[3]);
+        ref[reverseBits(i, N)] = re + I*im;
+        norm += re*re + im*im;
+    }
+    
+    // QFT|x> = sum_k exp(2 pi i x k / 2^N) |k> / sqrt(2^N), with a long double
+    // pi, since the double M_PI alone would limit the twiddles to double accuracy
+    const long double pi = acosl(-1.0L);
+    for (INDEX len=2; len<=numAmps; len*=2) {
+        for (INDEX j=0; j<len/2; j++) {
+            long double phase = 2 * pi * (long double) j / (long double) len;
+            long double complex w = cosl(phase) + I*sinl(phase);
+            for (INDEX k=j; k<numAmps; k+=len) {
+                long double complex a = ref[k];
+                long double complex b = w * ref[k + len/2];
+                ref[k] = a + b;
+                ref[k + len/2] = a - b;
+            }
+        }
+    }
+    
+    long double fac = 1 / sqrtl(norm * numAmps);
+    for (INDEX i=0; i<numAmps; i++)
+        ref[i] *= fac;
+    return ref;
+}
+
+void getQFTError(amp* psi, long double complex* ref, int N, double* maxErr, double* relErr, double* normErr) {
+    
+    // the largest amplitude error, the 2-norm error (relative to the unit
+    // norm of ref), and the drift of the norm from 1
+    long double maxDiff = 0, diffNorm = 0, norm = 0;
+    for (INDEX i=0; i<pow2(N); i++) {
+        long double complex d = (long double complex) psi[i] - ref[i];
+        long double diff = creall(d)*creall(d) + cimagl(d)*cimagl(d);
+        if (diff > maxDiff)
+            maxDiff = diff;
+        diffNorm += diff;
+        norm += getAbsSquared(psi[i]);
+    }
+    *maxErr = sqrtl(maxDiff);
+    *relErr = sqrtl(diffNorm);
+    *normErr = fabsl(1 - norm);
+}
+
+void errorReport(int minQubits, int maxQubits, char* outFN) {
+    
+    int outPrec = 5;
+    int numSizes = maxQubits - minQubits + 1;
+    amp* psi = createStatevector(maxQubits);
+    printf("[%s precision, %d to %d qubits]\n\n", PRECISION_NAME, minQubits, maxQubits);
+    
+    double maxErrs[NUM_ERROR_KERNELS][numSizes];
+    double relErrs[NUM_ERROR_KERNELS][numSizes];
+    double normErrs[NUM_ERROR_KERNELS][numSizes];
+    
+    for (int N=minQubits; N<=maxQubits; N++) {
+        long double complex* ref = getReferenceQFT(N, 123456789);
+        printf("%d qubits:\n", N);
+        
+        for (int k=0; k<NUM_ERROR_KERNELS; k++) {
+            int n = N - minQubits;
+            initSeededStatevector(psi, N, 123456789);
+            errorKernels[k](psi, N);
+            getQFTError(psi, ref, N, &maxErrs[k][n], &relErrs[k][n], &normErrs[k][n]);
+            printf("\t%s:\tmax %.3e, 2-norm %.3e, norm drift %.3e\n", 
+                errorKernelNames[k], maxErrs[k][n], relErrs[k][n], normErrs[k][n]);
+        }
+        free(ref);
+    }
+    
+    FILE* file = openAssocWrite(outFN);
+    writeStringToAssoc(file, "precision", PRECISION_NAME);
+    writeStringToAssoc(file, "note", "errors against a long double FFT, indexed by numQubits - minQubits");
+    writeIntToAssoc(file, "minQubits", minQubits);
+    writeIntToAssoc(file, "maxQubits", maxQubits);
+    writeIntToAssoc(file, "outPrec", outPrec);
+    for (int k=0; k<NUM_ERROR_KERNELS; k++) {
+        char buff[50];
+        sprintf(buff, "maxErr_%s", errorKernelNames[k]);
+        writeDoubleArrToAssoc(file, buff, maxErrs[k], numSizes, outPrec);
+        sprintf(buff, "relErr_%s", errorKernelNames[k]);
+        writeDoubleArrToAssoc(file, buff, relErrs[k], numSizes, outPrec);
+        sprintf(buff, "normErr_%s", errorKernelNames[k]);
+        writeDoubleArrToAssoc(file, buff, normErrs[k], numSizes, outPrec);
+    }
+    closeAssocWrite(file);
+    
+    free(psi);
+}
+
+
+
+int main(int argc, char* argv[]) {
+    
+    srand(123456789);
+    
+    if (argc == 1)
+        simpleTest();
+    
+    else if (argc == 5 && argv[1][0] == 't') {
+        int numQubits = atoi(argv[2]);
+        int numReps = atoi(argv[3]);
+        char* outFN = argv[4];
+        threadBenchmarking(numQubits, numReps, outFN);
+        
+    } else if (argc == 5 && argv[1][0] == 'v') {
+        int numQubits = atoi(argv[2]);
+        int numReps = atoi(argv[3]);
+        char* outFN = argv[4];
+        layoutBenchmarking(numQubits, numReps, outFN);
+        
+    } else if (argc == 5 && argv[1][0] == 'r') {
+        int numQubits = atoi(argv[2]);
+        int numReps = atoi(argv[3]);
+        char* outFN = argv[4];
+        rooflineBenchmarking(numQubits, numReps, outFN);
+        
+    } else if (argc == 5 && argv[1][0] == 'n') {
+        int numQubits = atoi(argv[2]);
+        int numReps = atoi(argv[3]);
+        char* outFN = argv[4];
+        numaBenchmarking(numQubits, numReps, outFN);
+        
+    } else if (argc == 5 && argv[1][0] == 'b') {
+        int numQubits = atoi(argv[2]);
+        int numReps = atoi(argv[3]);
+        char* outFN = argv[4];
+        batchBenchmarking(numQubits, numReps, outFN);
+        
+    } else if (argc == 5 && argv[1][0] == 'e') {
+        int minQubits = atoi(argv[2]);
+        int maxQubits = atoi(argv[3]);
+        char* outFN = argv[4];
+        errorReport(minQubits, maxQubits, outFN);
+        
+    } else
+        printf("call as either:\n\t./exec\n\t./exec [t/v/n/r/b] numQubits numReps outFN\n\t./exec e minQubits maxQubits outFN\n");
+    
+    return 0;
+}
+
+#endif // EXCLUDE_MAIN
\ No newline at end of file
@@ -7,6 +7,9 @@
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 #include "mmaformatter.h"
 
@@ -14,6 +17,10 @@ const char* BASE_TEN_FORMAT = "*10^";
 const char* ARRAY_DELIM_CHARS = ", ";
 const char* ARRAY_OUTER_CHARS[] = {"{", "}"};
 
+// the longest sci-not number, e.g. -1.(precision digits)*10^+308
+#define MMA_MAX_PRECISION 40
+#define MMA_MAX_NUMBER_CHARS (MMA_MAX_PRECISION + 16)
+
 
 
 
@@ -102,6 +109,76 @@ void writeNestedDoubleArr(
 
 
 
+/**
+ * writes 'number' into 'out' as a MMA compatible scientific notation string 
+ * with 'precision' digits after the decimal point, without any allocation.
+ * A format too long for outSize is truncated (still NULL-terminated).
+ * 
+ * @brief formats a double as a scientific notation string into a sized buffer
+ * @param out			buffer of outSize chars
+ * @param outSize		number of chars in out, including the NULL
+ * @param number		the double to convert
+ * @param precision	number of digits after decimal point in sci-not
+ * @return 				the number of chars written, excluding the NULL
+ */
+int formatScientificNotationOfSize(char* out, int outSize, double number, int precision) {
+	
+	// format with e, into the tail of out, leaving room to expand e to *10^
+	int numBase10Chars = strlen(BASE_TEN_FORMAT);
+	if (outSize <= numBase10Chars) {
+		if (outSize > 0)
+			out[0] = '\0';
+		return 0;
+	}
+	char* raw = out + numBase10Chars;
+	int rawSize = outSize - numBase10Chars;
+	int rawLen = snprintf(raw, rawSize, "%.*e", precision, number);
+	
+	// snprintf returns the untruncated length, of which only rawSize-1 was written
+	if (rawLen < 0)
+		rawLen = 0;
+	if (rawLen >= rawSize)
+		rawLen = rawSize - 1;
+	raw[rawLen] = '\0';
+	
+	// non-finite (or truncated) numbers have no exponent, and are written as is
+	char* e = strchr(raw, 'e');
+	if (e == NULL) {
+		memmove(out, raw, rawLen + 1);
+		return rawLen;
+	}
+	
+	// shift the mantissa left over the gap, then substitute *10^ for e
+	int mantLen = e - raw;
+	memmove(out, raw, mantLen);
+	memcpy(out + mantLen, BASE_TEN_FORMAT, numBase10Chars);
+	int expLen = rawLen - mantLen - 1;
+	memmove(out + mantLen + numBase10Chars, e + 1, expLen + 1);
+	return mantLen + numBase10Chars + expLen;
+}
+
+/**
+ * writes 'number' into 'out' as a MMA compatible scientific notation string 
+ * with 'precision' digits after the decimal point, without any allocation.
+ * 'out' must have space for MMA_MAX_NUMBER_CHARS, so precision is clamped
+ * to MMA_MAX_PRECISION.
+ * 
+ * @brief formats a double as a scientific notation string into a buffer
+ * @param out			buffer of at least MMA_MAX_NUMBER_CHARS chars
+ * @param number		the double to convert
+ * @param precision	number of digits after decimal point in sci-not,
+ * 						at most MMA_MAX_PRECISION
+ * @return 				the number of chars written, excluding the NULL
+ */
+int formatScientificNotation(char* out, double number, int precision) {
+	
+	if (precision > MMA_MAX_PRECISION)
+		precision = MMA_MAX_PRECISION;
+	if (precision < 0)
+		precision = 0;
+	return formatScientificNotationOfSize(out, MMA_MAX_NUMBER_CHARS, number, precision);
+}
+
 /**
  * returns 'number' as a MMA compatible scientific notation string 
  * with 'precision' digits after the decimal point. The returned string
@@ -114,47 +191,12 @@ void writeNestedDoubleArr(
  * 						should be freed
  */
 char* getScientificNotation(double number, int precision) {
-   
-   // build sci-not format string
-   int precDigits = 1 + ((precision>0)? floor(log10(abs(precision))) : 0);
-   int formatStrSize = sizeof(char)*(precDigits + 3 + 1); // % d . e NULL
-   char *formatStr = malloc(formatStrSize);
-   sprintf(formatStr, "%%.%de", precision); // e.g. %.5e
-   
-   // build sci-not string with e
-   ssize_t rawStrSize = snprintf(NULL, 0, formatStr, number);
-   char *rawStr = malloc(rawStrSize + 1); // NULL char
-   sprintf(rawStr, formatStr, number); // e.g. 1.23e+03
-   
-   // find the number of chars in our strings/substrings
-   int numBase10Chars = strlen(BASE_TEN_FORMAT);
-   int rawStrNumChars = rawStrSize/sizeof(char);
-   ssize_t newStrSize = rawStrSize + sizeof(BASE_TEN_FORMAT) - sizeof(char);
-   
-   // build sci-not string with *10^ by...
-   char *string = malloc(newStrSize + 1); // NULL
-   memset(string, 0x00, newStrSize+1);
-   
-   // copying old chars up until e
-   int rawInd=0;
-   while (rawStr[rawInd] != 'e') {
-       string[rawInd] = rawStr[rawInd];
-       rawInd += 1;
-   }
-   
-   // copying *10^ over
-   for (int copyInd=0; copyInd < numBase10Chars; copyInd++)
-       string[rawInd+copyInd] = BASE_TEN_FORMAT[copyInd];
-       
-   // copying over the rest of the original string (the exponent)
-   for (rawInd++; rawInd < rawStrNumChars; rawInd++)
-       string[rawInd + numBase10Chars - 1] = rawStr[rawInd];
-   
-   // clear 
-   free(formatStr);
-   free(rawStr);
-   
-   return string;
+	
+	// sized exactly, so that any precision is honoured
+	int size = snprintf(NULL, 0, "%.*e", precision, number) + strlen(BASE_TEN_FORMAT) + 1;
+	char* string = malloc(size);
+	formatScientificNotationOfSize(string, size, number, precision);
+	return string;
 }
 
 /**
@@ -195,13 +237,10 @@ char* convertDoubleArrToMMA(double* array, int length, int precision) {
    // for each number in the array
    for (int arrInd=0; arrInd < length; arrInd++) {
        
-       // convert it to scientific notation
-       char* numStr = getScientificNotation(array[arrInd], precision);
-       int lenNumStr = strlen(numStr);
-       
-       // write the sci-not number to the string
-       for (int charInd=0; charInd < lenNumStr; charInd++)
-           arrString[strInd + charInd] = numStr[charInd];
+       // write it in scientific notation directly to the string
+       char numStr[MMA_MAX_NUMBER_CHARS + precision];
+       int lenNumStr = formatScientificNotationOfSize(numStr, sizeof numStr, array[arrInd], precision);
+       memcpy(&arrString[strInd], numStr, lenNumStr);
        strInd += lenNumStr;
        
        // write the array delimiter to the string (except for last)
@@ -210,9 +249,6 @@ char* convertDoubleArrToMMA(double* array, int length, int precision) {
                arrString[strInd + delimInd]  = ARRAY_DELIM_CHARS[delimInd];
            strInd += sizeOfDelim;
        }
-       
-       // free sci-not malloc
-       free(numStr);
    }
    
    // write the close-array chars to the string
@@ -516,6 +552,389 @@ void writeNestedDoubleArrToAssoc(
 	// add comma and newline
 	fprintf(file, ",\n");
 }
+
+
+
+/* 
+ * streaming functions
+ */
+
+
+
+
+/* the functions above build whole strings before writing them, and remove 
+ * trailing delimiters by seeking backwards, which fails upon pipes. A stream
+ * instead formats every term directly into one reusable buffer, which is 
+ * written to the file whenever full, and precedes every term but the first 
+ * with its delimiter. It never allocates per term, nor seeks, so can write to
+ * stdout, pipes, or (via openAssocStreamFile) gzip.
+ */
+
+#define MMA_STREAM_CAPACITY (1 << 16)
+#define MMA_STREAM_MAX_DEPTH 32
+
+typedef struct {
+	
+	FILE* file;
+	pid_t gzipPid;		// the gzip process which file pipes into, else -1
+	int ownsFile;		// whether closing the stream closes file
+	
+	char buffer[MMA_STREAM_CAPACITY];
+	size_t size;
+	
+	// the current nesting (0 within the association), and whether each level
+	// has an element, so that the next must be preceded by a delimiter
+	int depth;
+	int hasElems[MMA_STREAM_MAX_DEPTH];
+	
+} MMAStream;
+
+void flushMMAStream(MMAStream* stream) {
+	
+	fwrite(stream->buffer, 1, stream->size, stream->file);
+	stream->size = 0;
+}
+
+static inline void reserveMMAStream(MMAStream* stream, size_t numChars) {
+	
+	if (stream->size + numChars > MMA_STREAM_CAPACITY)
+		flushMMAStream(stream);
+}
+
+static inline void putMMAStreamChars(MMAStream* stream, const char* chars, size_t numChars) {
+	
+	// strings longer than the buffer bypass it
+	if (numChars > MMA_STREAM_CAPACITY) {
+		flushMMAStream(stream);
+		fwrite(chars, 1, numChars, stream->file);
+		return;
+	}
+	reserveMMAStream(stream, numChars);
+	memcpy(&stream->buffer[stream->size], chars, numChars);
+	stream->size += numChars;
+}
+
+static inline void putMMAStreamString(MMAStream* stream, const char* string) {
+	
+	putMMAStreamChars(stream, string, strlen(string));
+}
+
+static inline void beginMMAStreamElem(MMAStream* stream) {
+	
+	// fields of the association are separated by lines, list elements by commas
+	if (stream->hasElems[stream->depth])
+		putMMAStreamString(stream, (stream->depth == 0)? ",\n" : ARRAY_DELIM_CHARS);
+	stream->hasElems[stream->depth] = 1;
+}
+
+static inline void beginMMAStreamField(MMAStream* stream, char* keyname) {
+	
+	// a NULL key is a list element, rather than a field of the association
+	beginMMAStreamElem(stream);
+	if (keyname != NULL) {
+		putMMAStreamString(stream, "\"");
+		putMMAStreamString(stream, keyname);
+		putMMAStreamString(stream, "\" -> ");
+	}
+}
+
+/**
+ * returns a stream which writes an association to an already open file, such
+ * as stdout or the end of a pipe. The stream must be eventually passed to 
+ * closeAssocStream, which does not close the file.
+ * 
+ * @brief begins streaming an association to an open file
+ * @param file		an open, writable file
+ * @return 			a stream to pass to subsequent stream functions
+ */
+MMAStream* openAssocStream(FILE* file) {
+	
+	MMAStream* stream = malloc(sizeof *stream);
+	stream->file = file;
+	stream->gzipPid = -1;
+	stream->ownsFile = 0;
+	stream->size = 0;
+	stream->depth = 0;
+	stream->hasElems[0] = 0;
+	putMMAStreamString(stream, "<|\n");
+	return stream;
+}
+
+/**
+ * returns a pipe into a new gzip process, which writes to the new file,
+ * executing gzip directly (rather than via a shell) so that any filename
+ * is safe. The pipe must be fclosed, and then the process waited upon.
+ * 
+ * @brief opens a pipe which gzips into a file
+ * @param filename		name of the (created or truncated) gzipped file
+ * @param pid			set to the gzip process id
+ * @return 				the pipe, or NULL if the file or process could not be created
+ */
+FILE* openGzipPipe(char* filename, pid_t* pid) {
+	
+	int outFD = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (outFD < 0)
+		return NULL;
+	
+	int fds[2];
+	if (pipe(fds) != 0) {
+		close(outFD);
+		return NULL;
+	}
+	
+	*pid = fork();
+	if (*pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		close(outFD);
+		return NULL;
+	}
+	
+	// the child reads the pipe and writes the file, as gzip's stdin and stdout
+	if (*pid == 0) {
+		dup2(fds[0], STDIN_FILENO);
+		dup2(outFD, STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		close(outFD);
+		execlp("gzip", "gzip", "-c", (char*) NULL);
+		_exit(127);
+	}
+	
+	close(fds[0]);
+	close(outFD);
+	FILE* file = fdopen(fds[1], "w");
+	if (file == NULL) {
+		close(fds[1]);
+		waitpid(*pid, NULL, 0);
+	}
+	return file;
+}
+
+/**
+ * returns a stream which writes an association to a new file, compressed
+ * by gzip if the filename ends in .gz. The stream must be eventually passed
+ * to closeAssocStream, which closes the file.
+ * 
+ * @brief begins streaming an association to a (possibly gzipped) file
+ * @param filename		name of the file to save the association to
+ * @return 				a stream to pass to subsequent stream functions,
+ * 						or NULL if the file could not be opened
+ */
+MMAStream* openAssocStreamFile(char* filename) {
+	
+	size_t len = strlen(filename);
+	int isGzip = (len > 3 && strcmp(&filename[len-3], ".gz") == 0);
+	
+	pid_t gzipPid = -1;
+	FILE* file = isGzip? openGzipPipe(filename, &gzipPid) : fopen(filename, "w");
+	if (file == NULL)
+		return NULL;
+	
+	MMAStream* stream = openAssocStream(file);
+	stream->gzipPid = gzipPid;
+	stream->ownsFile = 1;
+	return stream;
+}
+
+/**
+ * @brief finalises the association, so it is ready to read by MMA's Get,
+ * 		  and frees the stream
+ * @param stream	stream returned by openAssocStream or openAssocStreamFile
+ */
+void closeAssocStream(MMAStream* stream) {
+	
+	putMMAStreamString(stream, "\n|>");
+	flushMMAStream(stream);
+	
+	if (!stream->ownsFile)
+		fflush(stream->file);
+	else if (stream->gzipPid >= 0) {
+		fclose(stream->file);
+		waitpid(stream->gzipPid, NULL, 0);
+	} else
+		fclose(stream->file);
+	free(stream);
+}
+
+/**
+ * @brief adds an int to the streamed association, or to the current list if
+ * 		  keyname is NULL
+ * @param stream	stream returned by openAssocStream
+ * @param keyname	key to add to the association, or NULL within a list
+ * @param num		integer to add
+ */
+void writeIntToStream(MMAStream* stream, char* keyname, long long num) {
+	
+	beginMMAStreamField(stream, keyname);
+	reserveMMAStream(stream, 24);
+	stream->size += sprintf(&stream->buffer[stream->size], "%lld", num);
+}
+
+/**
+ * @brief adds a sci-not number to the streamed association, or to the 
+ * 		  current list if keyname is NULL
+ * @param stream		stream returned by openAssocStream
+ * @param keyname		key to add to the association, or NULL within a list
+ * @param num			number to add in sci-not
+ * @param precision	number of digits after decimal point in sci-not, 
+ * 						at most MMA_MAX_PRECISION
+ */
+void writeDoubleToStream(MMAStream* stream, char* keyname, double num, int precision) {
+	
+	beginMMAStreamField(stream, keyname);
+	reserveMMAStream(stream, MMA_MAX_NUMBER_CHARS);
+	stream->size += formatScientificNotation(&stream->buffer[stream->size], num, precision);
+}
+
+/**
+ * @brief adds a complex sci-not number, as re + I*(im), to the streamed
+ * 		  association, or to the current list if keyname is NULL
+ * @param stream		stream returned by openAssocStream
+ * @param keyname		key to add to the association, or NULL within a list
+ * @param re			real component
+ * @param im			imaginary component
+ * @param precision	number of digits after decimal point in sci-not
+ */
+void writeComplexToStream(MMAStream* stream, char* keyname, double re, double im, int precision) {
+	
+	beginMMAStreamField(stream, keyname);
+	reserveMMAStream(stream, 2*MMA_MAX_NUMBER_CHARS + 8);
+	char* out = &stream->buffer[stream->size];
+	int len = formatScientificNotation(out, re, precision);
+	memcpy(out + len, " + I*(", 6);
+	len += 6;
+	len += formatScientificNotation(out + len, im, precision);
+	out[len++] = ')';
+	stream->size += len;
+}
+
+/**
+ * @brief adds a string to the streamed association, or to the current list
+ * 		  if keyname is NULL
+ * @param stream	stream returned by openAssocStream
+ * @param keyname	key to add to the association, or NULL within a list
+ * @param string	string to add
+ */
+void writeStringToStream(MMAStream* stream, char* keyname, char* string) {
+	
+	beginMMAStreamField(stream, keyname);
+	putMMAStreamString(stream, "\"");
+	putMMAStreamString(stream, string);
+	putMMAStreamString(stream, "\"");
+}
+
+/**
+ * begins a list, to which subsequent writes with a NULL key add elements,
+ * including further (nested) lists begun with a NULL key, until the list 
+ * is ended by endStreamList. Lists may hence be streamed element by element,
+ * of a length unknown in advance.
+ * 
+ * @brief begins a list in the streamed association, or in the current list
+ * @param stream	stream returned by openAssocStream
+ * @param keyname	key to add to the association, or NULL within a list
+ */
+void beginStreamList(MMAStream* stream, char* keyname) {
+	
+	beginMMAStreamField(stream, keyname);
+	putMMAStreamString(stream, ARRAY_OUTER_CHARS[0]);
+	assert(stream->depth + 1 < MMA_STREAM_MAX_DEPTH);
+	stream->hasElems[++stream->depth] = 0;
+}
+
+/**
+ * @brief ends the list most recently begun by beginStreamList
+ * @param stream	stream returned by openAssocStream
+ */
+void endStreamList(MMAStream* stream) {
+	
+	assert(stream->depth > 0);
+	putMMAStreamString(stream, ARRAY_OUTER_CHARS[1]);
+	stream->depth--;
+}
+
+/**
+ * @brief adds a MMA array of integers to the streamed association
+ * @param stream	stream returned by openAssocStream
+ * @param keyname	key to add to the association, or NULL within a list
+ * @param arr		array of ints
+ * @param length	length of the array
+ */
+void writeIntArrToStream(MMAStream* stream, char* keyname, int* arr, long long length) {
+	
+	beginStreamList(stream, keyname);
+	for (long long i=0; i < length; i++)
+		writeIntToStream(stream, NULL, arr[i]);
+	endStreamList(stream);
+}
+
+/**
+ * @brief adds a MMA array of sci-not numbers to the streamed association
+ * @param stream		stream returned by openAssocStream
+ * @param keyname		key to add to the association, or NULL within a list
+ * @param arr			array of doubles
+ * @param length		length of the array
+ * @param precision	number of digits after decimal in sci-not
+ */
+void writeDoubleArrToStream(MMAStream* stream, char* keyname, double* arr, long long length, int precision) {
+	
+	beginStreamList(stream, keyname);
+	for (long long i=0; i < length; i++)
+		writeDoubleToStream(stream, NULL, arr[i], precision);
+	endStreamList(stream);
+}
+
+/**
+ * adds a MMA array of complex sci-not numbers to the streamed association,
+ * from interleaved real and imaginary components, as is the layout of a
+ * C99 double complex array. A statevector psi of double precision hence
+ * streams as writeComplexArrToStream(stream, "psi", (double*) psi, numAmps, precision),
+ * while one of -DPRECISION=1 (float complex) must first be converted to doubles.
+ * 
+ * @brief adds a MMA array of complex sci-not numbers to the streamed association
+ * @param stream		stream returned by openAssocStream
+ * @param keyname		key to add to the association, or NULL within a list
+ * @param reIm			array of 2*length doubles, alternating re and im
+ * @param length		number of complex numbers
+ * @param precision	number of digits after decimal in sci-not
+ */
+void writeComplexArrToStream(MMAStream* stream, char* keyname, double* reIm, long long length, int precision) {
+	
+	beginStreamList(stream, keyname);
+	for (long long i=0; i < length; i++)
+		writeComplexToStream(stream, NULL, reIm[2*i], reIm[2*i+1], precision);
+	endStreamList(stream);
+}
+
+/**
+ * @brief adds a numDimensions-nested MMA array of sci-not numbers, from a 
+ * 		  flat row-major array, to the streamed association
+ * @param stream		stream returned by openAssocStream
+ * @param keyname		key to add to the association, or NULL within a list
+ * @param arr			flat array of doubles
+ * @param numDimensions	number of nested dimensions
+ * @param lengths		length of each dimension, outermost first
+ * @param precision	number of digits after decimal in sci-not
+ */
+void writeNestedDoubleArrToStream(
+	MMAStream* stream, char* keyname, double* arr, int numDimensions, int* lengths, int precision
+) {
+	// base-case: write the inner array
+	if (numDimensions == 1) {
+		writeDoubleArrToStream(stream, keyname, arr, lengths[0], precision);
+		return;
+	}
+	
+	// recursive case: the elements are lists, each of innerSize doubles
+	long long innerSize = 1;
+	for (int d=1; d < numDimensions; d++)
+		innerSize *= lengths[d];
+	
+	beginStreamList(stream, keyname);
+	for (int i=0; i < lengths[0]; i++)
+		writeNestedDoubleArrToStream(stream, NULL, &arr[i*innerSize], numDimensions-1, &lengths[1], precision);
+	endStreamList(stream);
+}
 	
 #endif // MMA_FORMATTER_H_
 
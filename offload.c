@@ -0,0 +1,363 @@
+/* Accelerator counterparts of the control methods of local_controls.c, and of
+ * the Hadamard and merged phases of local_qft.c, upon arrays resident in
+ * device memory (device.h) via OpenMP target offload. Every kernel keeps the
+ * signature of its host counterpart, but its array is a device pointer. Each
+ * loop index is one device thread, so consecutive threads touch consecutive
+ * amplitudes wherever the method allows. Method A then branches divergently
+ * only within warps spanning a control below 5 (or 6 on AMD), method B never
+ * branches, and method D launches only the passing threads, so their
+ * ranking may differ from the host's. The benchmarks time the kernels apart
+ * from the host-device transfers of the whole array, which are reported as
+ * toDevice and fromDevice.
+ *
+ * Without an offload compiler or device, the target regions run upon the host,
+ * which checks correctness but times nothing of interest. Confirm the device
+ * is used by the "device" key of the output.
+ *
+ * It is important that inline functions are actually inlined, so pass optimisation
+ * flags (especially with Clang)
+ * run with:
+ *      gcc offload.c -O3 -lm -fopenmp -foffload=nvptx-none -o offload
+ *      clang offload.c -O3 -lm -fopenmp -fopenmp-targets=nvptx64 -o offload
+ *      ./offload [s/m/q] numQubits numReps outFN
+ */
+
+#ifdef EXCLUDE_MAIN
+#include "local_qft.c"
+#include "local_controls.c"
+#else
+#define EXCLUDE_MAIN
+#include "local_qft.c"
+#include "local_controls.c"
+#undef EXCLUDE_MAIN
+#endif
+
+#include "device.h"
+
+
+
+/* array management */
+
+void initDeviceArray(qreal* amps, INDEX numAmps) {
+    INDEX i;
+    #pragma omp target teams distribute parallel for is_device_ptr(amps)
+    for (i=0; i<numAmps; i++)
+        amps[i] = 1;
+}
+
+
+
+/* single control methods */
+
+void s_deviceMethodA(qreal* amps, INDEX numAmps, int c) {
+    INDEX i;
+    #pragma omp target teams distribute parallel for is_device_ptr(amps)
+    for (i=0; i<numAmps; i++)
+        if (getBit(i, c))
+            amps[i] = f(amps[i]);
+}
+
+void s_deviceMethodB(qreal* amps, INDEX numAmps, int c) {
+    INDEX i;
+    #pragma omp target teams distribute parallel for is_device_ptr(amps)
+    for (i=0; i<numAmps; i++) {
+        int b = getBit(i, c);
+        amps[i] = (1-b)*amps[i] + b*f(amps[i]);
+    }
+}
+
+void s_deviceMethodC(qreal* amps, INDEX numAmps, int c) {
+    INDEX jNum = numAmps >> (c+1);
+    INDEX iNum = pow2(c);
+    INDEX j,i;
+    #pragma omp target teams distribute parallel for collapse(2) is_device_ptr(amps)
+    for (j=0; j<jNum; j++) {
+        for (i=0; i<iNum; i++) {
+            INDEX j1i = flipBit(getZeroBitFromAffix(j, i, c), c);
+            amps[j1i] = f(amps[j1i]);
+        }
+    }
+}
+
+void s_deviceMethodD(qreal* amps, INDEX numAmps, int c) {
+    INDEX l1 = numAmps >> 1;
+    INDEX m;
+    #pragma omp target teams distribute parallel for is_device_ptr(amps)
+    for (m=0; m<l1; m++) {
+        INDEX i = flipBit(insertZeroBit(m, c), c);
+        amps[i] = f(amps[i]);
+    }
+}
+
+#define NUM_S_DEVICE_METHODS 4
+
+void (*s_deviceMethods[NUM_S_DEVICE_METHODS]) (qreal* amps, INDEX numAmps, int c) = {
+    s_deviceMethodA, s_deviceMethodB, s_deviceMethodC, s_deviceMethodD
+};
+char* s_deviceMethodNames[NUM_S_DEVICE_METHODS] = {"A", "B", "C", "D"};
+
+
+
+/* many control methods */
+
+void m_deviceMethodA(qreal* amps, INDEX numAmps, int* ctrls, int numCtrls) {
+    INDEX cMask = getBitMask(ctrls, numCtrls);
+    INDEX i;
+    #pragma omp target teams distribute parallel for is_device_ptr(amps)
+    for (i=0; i<numAmps; i++)
+        if (bitsAreAllOne(i, cMask))
+            amps[i] = f(amps[i]);
+}
+
+void m_deviceMethodB(qreal* amps, INDEX numAmps, int* ctrls, int numCtrls) {
+    INDEX cMask = getBitMask(ctrls, numCtrls);
+    INDEX i;
+    #pragma omp target teams distribute parallel for is_device_ptr(amps)
+    for (i=0; i<numAmps; i++) {
+        int b = bitsAreAllOne(i, cMask);
+        amps[i] = (1-b)*amps[i] + b*f(amps[i]);
+    }
+}
+
+void m_deviceMethodD(qreal* amps, INDEX numAmps, int* ctrls, int numCtrls) {
+    INDEX lNum = numAmps >> numCtrls;
+    INDEX l;
+    #pragma omp target teams distribute parallel for is_device_ptr(amps) map(to:ctrls[0:numCtrls])
+    for (l=0; l<lNum; l++) {
+        INDEX j = l;
+        for (int c=0; c<numCtrls; c++)
+            j = flipBit(insertZeroBit(j, ctrls[c]), ctrls[c]);
+        amps[j] = f(amps[j]);
+    }
+}
+
+#define NUM_M_DEVICE_METHODS 3
+
+void (*m_deviceMethods[NUM_M_DEVICE_METHODS]) (qreal* amps, INDEX numAmps, int* ctrls, int numCtrls) = {
+    m_deviceMethodA, m_deviceMethodB, m_deviceMethodD
+};
+char* m_deviceMethodNames[NUM_M_DEVICE_METHODS] = {"A", "B", "D"};
+
+
+
+/* QFT gates */
+
+void applyDeviceHadamard(amp* psi, int t, int N) {
+
+    // one thread per pair |j>|0>|k> and |j>|1>|k>, rather than collapse(2)
+    const qreal fac = 1/sqrt(2);
+    const INDEX numPairs = pow2(N-1);
+    INDEX m;
+    #pragma omp target teams distribute parallel for is_device_ptr(psi)
+    for (m=0; m<numPairs; m++) {
+        INDEX j0k = insertZeroBit(m, t);
+        INDEX j1k = flipBit(j0k, t);
+
+        amp a1 = psi[j0k];
+        amp a2 = psi[j1k];
+
+        psi[j0k] = fac*a1 + fac*a2;
+        psi[j1k] = fac*a1 - fac*a2;
+    }
+}
+
+void applyDeviceMergedPhases(amp* psi, int tMax, int N) {
+
+    // |j>|1>|k>
+    const INDEX numAmps = pow2(N-1);
+    const INDEX kMask = pow2(tMax)-1;
+    const double fac = (M_PI / (double) pow2(tMax));
+    INDEX m;
+    #pragma omp target teams distribute parallel for is_device_ptr(psi)
+    for (m=0; m<numAmps; m++) {
+        INDEX j1k = flipBit(insertZeroBit(m, tMax), tMax);
+        double theta = fac * (j1k & kMask);
+        psi[j1k] *= expI(theta);
+    }
+}
+
+
+
+/* launch */
+
+#ifndef EXCLUDE_MAIN
+
+void writeDeviceHeaderToAssoc(FILE* file, int numQubits, int numReps, int outPrec) {
+    writeStringToAssoc(file, "precision", PRECISION_NAME);
+    writeStringToAssoc(file, "device", isDeviceOffloaded()? "offloaded" : "host fallback");
+    writeStringToAssoc(file, "note", "timings are already per-rep; kernels exclude the transfers, which move the whole array");
+    writeIntToAssoc(file, "numQubits", numQubits);
+    writeIntToAssoc(file, "numReps", numReps);
+    writeIntToAssoc(file, "outPrec", outPrec);
+}
+
+void timeDeviceTransfers(void* devPtr, void* hostPtr, size_t numBytes, int numReps, HarnessStats* toDevice, HarnessStats* fromDevice) {
+
+    // the host caches are irrelevant to the transfer, so are not flushed
+    HarnessConfig cfg = {.numWarmups = 1, .numReps = numReps};
+    cfg.bytesPerRep = numBytes;
+    cfg.ampsPerRep = 0;
+    HARNESS_RUN(cfg, *toDevice, , copyToDevice(devPtr, hostPtr, numBytes));
+    HARNESS_RUN(cfg, *fromDevice, , copyFromDevice(hostPtr, devPtr, numBytes));
+}
+
+void s_deviceBenchmarking(int numQubits, int numReps, char* outFN) {
+
+    int outPrec = 5;
+    INDEX numAmps = pow2(numQubits);
+    qreal* hostAmps = malloc(numAmps * sizeof *hostAmps);
+    qreal* amps = createDeviceArray(numAmps * sizeof *amps);
+    if (amps == NULL) {
+        printf("could not allocate %d qubits upon the device\n", numQubits);
+        free(hostAmps);
+        return;
+    }
+    printf("[%d qubits, %s]\n\n", numQubits, isDeviceOffloaded()? "offloaded" : "host fallback");
+
+    initArray(hostAmps, numAmps);
+    HarnessStats toDevice, fromDevice;
+    timeDeviceTransfers(amps, hostAmps, numAmps * sizeof *amps, numReps, &toDevice, &fromDevice);
+
+    // the passing half of the amplitudes are each read and written once
+    HarnessConfig cfg = {.numWarmups = 1, .numReps = numReps};
+    cfg.ampsPerRep = numAmps / 2;
+    cfg.bytesPerRep = 2 * sizeof *amps * cfg.ampsPerRep;
+
+    HarnessStats stats[NUM_S_DEVICE_METHODS][numQubits];
+    for (int m=0; m<NUM_S_DEVICE_METHODS; m++)
+        for (int c=0; c<numQubits; c++)
+            HARNESS_RUN(cfg, stats[m][c],
+                initDeviceArray(amps, numAmps),
+                s_deviceMethods[m](amps, numAmps, c));
+
+    FILE* file = openAssocWrite(outFN);
+    writeDeviceHeaderToAssoc(file, numQubits, numReps, outPrec);
+    writeHarnessStatsArrToAssoc(file, "toDevice", &toDevice, 1, outPrec);
+    writeHarnessStatsArrToAssoc(file, "fromDevice", &fromDevice, 1, outPrec);
+    for (int m=0; m<NUM_S_DEVICE_METHODS; m++)
+        writeHarnessStatsArrToAssoc(file, s_deviceMethodNames[m], stats[m], numQubits, outPrec);
+    closeAssocWrite(file);
+
+    destroyDeviceArray(amps);
+    free(hostAmps);
+}
+
+void m_deviceBenchmarking(int numQubits, int numReps, char* outFN) {
+
+    int outPrec = 10;
+    INDEX numAmps = pow2(numQubits);
+    qreal* hostAmps = malloc(numAmps * sizeof *hostAmps);
+    qreal* amps = createDeviceArray(numAmps * sizeof *amps);
+    if (amps == NULL) {
+        printf("could not allocate %d qubits upon the device\n", numQubits);
+        free(hostAmps);
+        return;
+    }
+    printf("[%d qubits, %s]\n\n", numQubits, isDeviceOffloaded()? "offloaded" : "host fallback");
+
+    initArray(hostAmps, numAmps);
+    HarnessStats toDevice, fromDevice;
+    timeDeviceTransfers(amps, hostAmps, numAmps * sizeof *amps, numReps, &toDevice, &fromDevice);
+
+    HarnessConfig cfg = {.numWarmups = 1, .numReps = numReps};
+    int numCalls = cfg.numWarmups + cfg.numReps;
+
+    HarnessStats stats[NUM_M_DEVICE_METHODS][numQubits+1];
+    for (int m=0; m<NUM_M_DEVICE_METHODS; m++)
+        for (int i=0; i<(numQubits+1); i++)
+            stats[m][i] = getEmptyHarnessStats();
+
+    for (int numCtrls=2; numCtrls<=numQubits; numCtrls++) {
+
+        // every call (including warm-ups) gets new controls, shared by all methods
+        int ctrls[numCalls][numCtrls];
+        for (int r=0; r<numCalls; r++)
+            getSortedRandomSubReg(ctrls[r], numCtrls, numQubits);
+
+        cfg.ampsPerRep = numAmps >> numCtrls;
+        cfg.bytesPerRep = 2 * sizeof *amps * cfg.ampsPerRep;
+
+        for (int m=0; m<NUM_M_DEVICE_METHODS; m++)
+            HARNESS_RUN(cfg, stats[m][numCtrls],
+                initDeviceArray(amps, numAmps),
+                m_deviceMethods[m](amps, numAmps, ctrls[harnessRep], numCtrls));
+    }
+
+    FILE* file = openAssocWrite(outFN);
+    writeDeviceHeaderToAssoc(file, numQubits, numReps, outPrec);
+    writeHarnessStatsArrToAssoc(file, "toDevice", &toDevice, 1, outPrec);
+    writeHarnessStatsArrToAssoc(file, "fromDevice", &fromDevice, 1, outPrec);
+    for (int m=0; m<NUM_M_DEVICE_METHODS; m++)
+        writeHarnessStatsArrToAssoc(file, m_deviceMethodNames[m], stats[m], numQubits+1, outPrec);
+    closeAssocWrite(file);
+
+    destroyDeviceArray(amps);
+    free(hostAmps);
+}
+
+void q_deviceBenchmarking(int numQubits, int numReps, char* outFN) {
+
+    int outPrec = 5;
+    INDEX numAmps = pow2(numQubits);
+    amp* hostPsi = createStatevector(numQubits);
+    amp* psi = createDeviceArray(numAmps * sizeof *psi);
+    if (psi == NULL) {
+        printf("could not allocate %d qubits upon the device\n", numQubits);
+        free(hostPsi);
+        return;
+    }
+    printf("[%d qubits, %s]\n\n", numQubits, isDeviceOffloaded()? "offloaded" : "host fallback");
+
+    initSeededStatevector(hostPsi, numQubits, 123456789);
+    HarnessStats toDevice, fromDevice;
+    timeDeviceTransfers(psi, hostPsi, numAmps * sizeof *psi, numReps, &toDevice, &fromDevice);
+
+    // both gates are unitary so need no reinitialisation; the Hadamard moves
+    // every amplitude, the phases only those with the target bit set
+    HarnessConfig cfg = {.numWarmups = 1, .numReps = numReps};
+    HarnessStats hadStats[numQubits];
+    HarnessStats phaseStats[numQubits];
+    for (int t=0; t<numQubits; t++) {
+        cfg.ampsPerRep = numAmps;
+        cfg.bytesPerRep = 2 * sizeof *psi * cfg.ampsPerRep;
+        HARNESS_RUN(cfg, hadStats[t], , applyDeviceHadamard(psi, t, numQubits));
+
+        cfg.ampsPerRep = numAmps / 2;
+        cfg.bytesPerRep = 2 * sizeof *psi * cfg.ampsPerRep;
+        HARNESS_RUN(cfg, phaseStats[t], , applyDeviceMergedPhases(psi, t, numQubits));
+    }
+
+    FILE* file = openAssocWrite(outFN);
+    writeDeviceHeaderToAssoc(file, numQubits, numReps, outPrec);
+    writeHarnessStatsArrToAssoc(file, "toDevice", &toDevice, 1, outPrec);
+    writeHarnessStatsArrToAssoc(file, "fromDevice", &fromDevice, 1, outPrec);
+    writeHarnessStatsArrToAssoc(file, "hadamard", hadStats, numQubits, outPrec);
+    writeHarnessStatsArrToAssoc(file, "mergedPhases", phaseStats, numQubits, outPrec);
+    closeAssocWrite(file);
+
+    destroyDeviceArray(psi);
+    free(hostPsi);
+}
+
+int main(int argc, char* argv[]) {
+
+    if (argc != 5 || (argv[1][0] != 's' && argv[1][0] != 'm' && argv[1][0] != 'q')) {
+        printf("call as:\n\t./offload [s/m/q] numQubits numReps outFN\n");
+        return 0;
+    }
+
+    srand(123456789);
+    int numQubits = atoi(argv[2]);
+    int numReps = atoi(argv[3]);
+    char* outFN = argv[4];
+
+    if (argv[1][0] == 's')
+        s_deviceBenchmarking(numQubits, numReps, outFN);
+    else if (argv[1][0] == 'm')
+        m_deviceBenchmarking(numQubits, numReps, outFN);
+    else
+        q_deviceBenchmarking(numQubits, numReps, outFN);
+    return 0;
+}
+
+#endif // EXCLUDE_MAIN
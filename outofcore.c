@@ -0,0 +1,234 @@
+/* Out-of-core counterparts of the Hadamard of local_qft.c and the control
+ * method D of local_controls.c, upon a vector stored in a memory-mapped file
+ * (outofcore.h) so that its size is limited by disk rather than RAM. The
+ * vector is processed in chunks of 2^chunkQubits amplitudes, which mimic the
+ * partitions of 2^(numQubits-chunkQubits) MPI ranks: a target below
+ * chunkQubits is applied within each chunk in turn, streaming sequentially
+ * through the file, while a higher target pairs every chunk with the one
+ * differing in the target's bit, like the pairwise exchange of distributed.h.
+ * A control at or above chunkQubits is fixed throughout a chunk, so a failing
+ * chunk is never read at all, as in distributed_controls.c.
+ *
+ * The benchmarks time each repetition until the vector is fully written back,
+ * so report the sustained throughput of the disk. Use a path upon the NVMe
+ * device to be measured, with enough free space for 2^numQubits amplitudes
+ * (16 bytes each for h, 8 for s, halved by -DPRECISION=1), e.g. 35 qubits needs 512 GiB (h).
+ *
+ * It is important that inline functions are actually inlined, so pass optimisation
+ * flags (especially with Clang)
+ * run with:
+ *      gcc outofcore.c -O3 -lm -fopenmp -march=native -o ooc
+ *      ./ooc [h/s] path numQubits chunkQubits numReps outFN
+ */
+
+#ifdef EXCLUDE_MAIN
+#include "local_qft.c"
+#include "local_controls.c"
+#else
+#define EXCLUDE_MAIN
+#include "local_qft.c"
+#include "local_controls.c"
+#undef EXCLUDE_MAIN
+#endif
+
+#include "outofcore.h"
+
+
+
+/* gates */
+
+void applyChunkPairHadamard(amp* lo, amp* hi, INDEX numAmps) {
+
+    // lo and hi are the amplitudes with the target bit 0 and 1 respectively
+    INDEX i;
+    amp a, b;
+    qreal fac = 1/sqrt(2);
+    #pragma omp parallel for shared(lo,hi,numAmps,fac) private(i,a,b) schedule(static)
+    for (i=0; i<numAmps; i++) {
+        a = lo[i];
+        b = hi[i];
+        lo[i] = fac * (a + b);
+        hi[i] = fac * (a - b);
+    }
+}
+
+void applyOutOfCoreHadamard(OutOfCoreVector* psi, int t) {
+
+    INDEX numChunks = getNumChunks(psi);
+    INDEX chunkAmps = getNumChunkAmps(psi);
+    int C = psi->chunkQubits;
+
+    // low targets stream through the chunks in order
+    if (t < C) {
+        for (INDEX c=0; c<numChunks; c++) {
+            prefetchChunk(psi, c+1);
+            applyHadamard(getChunk(psi, c), t, C);
+            releaseChunk(psi, c);
+        }
+        return;
+    }
+
+    // high targets pair chunk c with c + stride, which streams two regions in step
+    INDEX stride = pow2(t - C);
+    for (INDEX c=0; c<numChunks; c++) {
+        if (getBit(c, t - C))
+            continue;
+        INDEX next = (getBit(c+1, t - C))? c+1+stride : c+1;
+        prefetchChunk(psi, next);
+        prefetchChunk(psi, next + stride);
+        applyChunkPairHadamard(getChunk(psi, c), getChunk(psi, c + stride), chunkAmps);
+        releaseChunk(psi, c);
+        releaseChunk(psi, c + stride);
+    }
+}
+
+
+
+/* control methods */
+
+void initOutOfCoreArray(OutOfCoreVector* amps) {
+
+    for (INDEX c=0; c<getNumChunks(amps); c++) {
+        prefetchChunk(amps, c+1);
+        initArray(getChunk(amps, c), getNumChunkAmps(amps));
+        releaseChunk(amps, c);
+    }
+}
+
+void m_outOfCoreMethodD(OutOfCoreVector* amps, int* ctrls, int numCtrls) {
+
+    INDEX numChunks = getNumChunks(amps);
+    INDEX chunkAmps = getNumChunkAmps(amps);
+    int C = amps->chunkQubits;
+
+    // the (increasing) controls within a chunk, and a mask of those selecting chunks
+    int localCtrls[numCtrls];
+    int numLocalCtrls = 0;
+    INDEX chunkMask = 0;
+    for (int n=0; n<numCtrls; n++) {
+        if (ctrls[n] < C)
+            localCtrls[numLocalCtrls++] = ctrls[n];
+        else
+            chunkMask = flipBit(chunkMask, ctrls[n] - C);
+    }
+
+    // chunks failing a control are skipped, so never leave the disk; the passing
+    // chunks set every bit of chunkMask, and are enumerated by a masked increment
+    for (INDEX c=chunkMask; c<numChunks; ) {
+        INDEX next = ((c | chunkMask) + 1) | chunkMask;
+        prefetchChunk(amps, next);
+
+        qreal* chunk = getChunk(amps, c);
+        if (numLocalCtrls == 0)
+            applyUncontrolled(chunk, chunkAmps);
+        else
+            m_methodD(chunk, chunkAmps, localCtrls, numLocalCtrls);
+        releaseChunk(amps, c);
+        c = next;
+    }
+}
+
+void s_outOfCoreMethodD(OutOfCoreVector* amps, int c) {
+    m_outOfCoreMethodD(amps, &c, 1);
+}
+
+
+
+/* launch */
+
+#ifndef EXCLUDE_MAIN
+
+void h_outOfCoreBenchmarking(char* path, int numQubits, int chunkQubits, int numReps, char* outFN) {
+
+    int outPrec = 5;
+    OutOfCoreVector psi = createOutOfCoreVector(path, numQubits, chunkQubits, sizeof(amp));
+    if (psi.data == NULL)
+        return;
+    printf("[%d qubits, %lld chunks of %d qubits]\n\n", numQubits, getNumChunks(&psi), chunkQubits);
+
+    initSeededOutOfCoreStatevector(&psi, 123456789);
+    syncOutOfCoreVector(&psi);
+
+    // every amplitude is read and written once, and the Hadamard is unitary so
+    // needs no reinitialisation
+    HarnessConfig cfg = {.numWarmups = 0, .numReps = numReps};
+    cfg.ampsPerRep = pow2(numQubits);
+    cfg.bytesPerRep = 2 * sizeof(amp) * cfg.ampsPerRep;
+
+    HarnessStats stats[numQubits];
+    for (int t=0; t<numQubits; t++) {
+        HARNESS_RUN(cfg, stats[t], ,
+            applyOutOfCoreHadamard(&psi, t); syncOutOfCoreVector(&psi));
+        printf("t=%d\n", t);
+        printHarnessStats(stats[t]);
+    }
+
+    FILE* file = openAssocWrite(outFN);
+    writeStringToAssoc(file, "precision", PRECISION_NAME);
+    writeStringToAssoc(file, "note", "timings are already per-rep, including write-back to disk");
+    writeIntToAssoc(file, "numQubits", numQubits);
+    writeIntToAssoc(file, "chunkQubits", chunkQubits);
+    writeIntToAssoc(file, "numReps", numReps);
+    writeIntToAssoc(file, "outPrec", outPrec);
+    writeHarnessStatsArrToAssoc(file, "H", stats, numQubits, outPrec);
+    closeAssocWrite(file);
+
+    destroyOutOfCoreVector(&psi);
+}
+
+void s_outOfCoreBenchmarking(char* path, int numQubits, int chunkQubits, int numReps, char* outFN) {
+
+    int outPrec = 5;
+    OutOfCoreVector amps = createOutOfCoreVector(path, numQubits, chunkQubits, sizeof(qreal));
+    if (amps.data == NULL)
+        return;
+    printf("[%d qubits, %lld chunks of %d qubits]\n\n", numQubits, getNumChunks(&amps), chunkQubits);
+
+    // the passing half of the amplitudes are each read and written once
+    HarnessConfig cfg = {.numWarmups = 0, .numReps = numReps};
+    cfg.ampsPerRep = pow2(numQubits) / 2;
+    cfg.bytesPerRep = 2 * sizeof(qreal) * cfg.ampsPerRep;
+
+    HarnessStats stats[numQubits];
+    for (int c=0; c<numQubits; c++) {
+        HARNESS_RUN(cfg, stats[c],
+            initOutOfCoreArray(&amps); syncOutOfCoreVector(&amps),
+            s_outOfCoreMethodD(&amps, c); syncOutOfCoreVector(&amps));
+        printf("c=%d\n", c);
+        printHarnessStats(stats[c]);
+    }
+
+    FILE* file = openAssocWrite(outFN);
+    writeStringToAssoc(file, "precision", PRECISION_NAME);
+    writeStringToAssoc(file, "note", "timings are already per-rep, including write-back to disk; bw (GB/s) and rate (amps/s) count only passing amps");
+    writeIntToAssoc(file, "numQubits", numQubits);
+    writeIntToAssoc(file, "chunkQubits", chunkQubits);
+    writeIntToAssoc(file, "numReps", numReps);
+    writeIntToAssoc(file, "outPrec", outPrec);
+    writeHarnessStatsArrToAssoc(file, "s_D", stats, numQubits, outPrec);
+    closeAssocWrite(file);
+
+    destroyOutOfCoreVector(&amps);
+}
+
+int main(int argc, char* argv[]) {
+
+    if (argc != 7 || (argv[1][0] != 'h' && argv[1][0] != 's')) {
+        printf("call as:\n\t./ooc [h/s] path numQubits chunkQubits numReps outFN\n");
+        return 0;
+    }
+
+    char* path = argv[2];
+    int numQubits = atoi(argv[3]);
+    int chunkQubits = atoi(argv[4]);
+    int numReps = atoi(argv[5]);
+    char* outFN = argv[6];
+
+    if (argv[1][0] == 'h')
+        h_outOfCoreBenchmarking(path, numQubits, chunkQubits, numReps, outFN);
+    else
+        s_outOfCoreBenchmarking(path, numQubits, chunkQubits, numReps, outFN);
+    return 0;
+}
+
+#endif // EXCLUDE_MAIN
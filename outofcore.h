@@ -0,0 +1,169 @@
+#ifndef OUT_OF_CORE_H
+#define OUT_OF_CORE_H
+
+#include "utilities.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+
+/* a vector of 2^numQubits amplitudes stored in a file (ideally upon NVMe) and
+ * mapped into memory, so it may exceed RAM, with the page cache serving as the
+ * cache of the recently used parts. It is processed in chunks of 2^chunkQubits
+ * contiguous amplitudes, in order, each prefetched (MADV_WILLNEED) one chunk
+ * ahead of its use and released after, with its write-back begun immediately
+ * so that every released page is soon clean and cheap to evict. Chunks play
+ * the part of the MPI ranks of distributed.h: kernels upon a qubit below
+ * chunkQubits are applied within every chunk, while kernels upon a higher
+ * qubit pair chunks (or, for controls, select them), exactly as ranks pair
+ * for communication. The chunk count therefore reproduces the memory-access
+ * pattern of that many ranks, on one machine.
+ */
+
+typedef struct {
+
+    int fd;
+    void* data;             // NULL if the vector could not be created
+    int numQubits;
+    int chunkQubits;
+    size_t ampBytes;        // e.g. sizeof(amp), or sizeof(double) for the control methods
+    size_t numBytes;
+
+} OutOfCoreVector;
+
+
+
+/* management */
+
+OutOfCoreVector createOutOfCoreVector(char* path, int numQubits, int chunkQubits, size_t ampBytes) {
+
+    // the file is created (or truncated) sparse, so costs no disk until written
+    OutOfCoreVector vec = {.fd = -1, .data = NULL, .numQubits = numQubits, .chunkQubits = chunkQubits, .ampBytes = ampBytes};
+    vec.numBytes = pow2(numQubits) * ampBytes;
+#ifdef __linux__
+    size_t chunkBytes = pow2(chunkQubits) * ampBytes;
+    if (chunkQubits > numQubits || chunkBytes % sysconf(_SC_PAGESIZE) != 0) {
+        printf("chunks of %d qubits must fit the vector, and be whole pages\n", chunkQubits);
+        return vec;
+    }
+
+    vec.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (vec.fd < 0 || ftruncate(vec.fd, vec.numBytes) != 0) {
+        printf("could not create %s (%zu bytes)\n", path, vec.numBytes);
+        if (vec.fd >= 0)
+            close(vec.fd);
+        vec.fd = -1;
+        return vec;
+    }
+
+    void* data = mmap(NULL, vec.numBytes, PROT_READ | PROT_WRITE, MAP_SHARED, vec.fd, 0);
+    if (data == MAP_FAILED) {
+        printf("could not map %s\n", path);
+        close(vec.fd);
+        vec.fd = -1;
+        return vec;
+    }
+
+    // chunks are accessed sequentially, so aggressive readahead pays
+    madvise(data, vec.numBytes, MADV_SEQUENTIAL);
+    vec.data = data;
+#else
+    printf("out-of-core vectors require Linux\n");
+#endif
+    return vec;
+}
+
+void destroyOutOfCoreVector(OutOfCoreVector* vec) {
+
+    // the file persists, so may be reopened or deleted by the caller
+#ifdef __linux__
+    if (vec->data != NULL)
+        munmap(vec->data, vec->numBytes);
+    if (vec->fd >= 0)
+        close(vec->fd);
+#endif
+    vec->data = NULL;
+    vec->fd = -1;
+}
+
+FORCE_INLINE INDEX getNumChunks(OutOfCoreVector* vec) {
+    return pow2(vec->numQubits - vec->chunkQubits);
+}
+
+FORCE_INLINE INDEX getNumChunkAmps(OutOfCoreVector* vec) {
+    return pow2(vec->chunkQubits);
+}
+
+FORCE_INLINE void* getChunk(OutOfCoreVector* vec, INDEX chunk) {
+    return (char*) vec->data + chunk * getNumChunkAmps(vec) * vec->ampBytes;
+}
+
+
+
+/* residency hints */
+
+void prefetchChunk(OutOfCoreVector* vec, INDEX chunk) {
+
+    // asynchronously reads the chunk into the page cache; ignored beyond the end
+    if (chunk >= getNumChunks(vec))
+        return;
+#ifdef __linux__
+    madvise(getChunk(vec, chunk), getNumChunkAmps(vec) * vec->ampBytes, MADV_WILLNEED);
+#endif
+}
+
+void releaseChunk(OutOfCoreVector* vec, INDEX chunk) {
+
+    // begins writing the (possibly dirty) chunk back, without waiting, and drops
+    // it from this mapping; its pages stay in the page cache until evicted
+#ifdef __linux__
+    size_t chunkBytes = getNumChunkAmps(vec) * vec->ampBytes;
+    sync_file_range(vec->fd, chunk * chunkBytes, chunkBytes, SYNC_FILE_RANGE_WRITE);
+    madvise(getChunk(vec, chunk), chunkBytes, MADV_DONTNEED);
+#endif
+}
+
+void syncOutOfCoreVector(OutOfCoreVector* vec) {
+
+    // waits until the whole vector is upon disk, e.g. so timings include write-back
+#ifdef __linux__
+    msync(vec->data, vec->numBytes, MS_SYNC);
+#endif
+}
+
+
+
+/* initialisation */
+
+void initSeededOutOfCoreStatevector(OutOfCoreVector* vec, uint64_t seed) {
+
+    // chunk by chunk, giving the same state as initSeededStatevector when
+    // chunkQubits >= NORM_BLOCK_QUBITS, since the chunk norms then complete
+    // the same pairwise tree
+    INDEX numChunks = getNumChunks(vec);
+    INDEX chunkAmps = getNumChunkAmps(vec);
+    double* chunkNorms = malloc(numChunks * sizeof *chunkNorms);
+
+    for (INDEX c=0; c<numChunks; c++) {
+        prefetchChunk(vec, c+1);
+        chunkNorms[c] = setSeededAmps(getChunk(vec, c), chunkAmps, c * chunkAmps, seed);
+        releaseChunk(vec, c);
+    }
+
+    double fac = 1/sqrt(getPairwiseSum(chunkNorms, numChunks));
+    for (INDEX c=0; c<numChunks; c++) {
+        prefetchChunk(vec, c+1);
+        scaleStatevector(getChunk(vec, c), chunkAmps, fac);
+        releaseChunk(vec, c);
+    }
+    free(chunkNorms);
+}
+
+
+
+#endif // OUT_OF_CORE_H
@@ -0,0 +1,220 @@
+#ifndef ROOFLINE_H
+#define ROOFLINE_H
+
+#include "utilities.h"
+#include "harness.h"
+
+
+
+/* a roofline model of the host, against which a kernel's achieved performance
+ * is judged. The peak bandwidth is measured by the STREAM kernels (McCalpin,
+ * 1995) upon arrays four times the LLC, plus an in-place update which, like 
+ * the statevector kernels, avoids STREAM's uncounted write-allocations. The
+ * peak arithmetic rate is that of independent chains of vector multiply-adds
+ * in registers, coded with vector extensions so that their width does not 
+ * depend upon auto-vectorisation (though their contraction into FMAs needs 
+ * -O2). Both use every thread, with the flags of the kernels. A kernel moving
+ * numBytes and performing numFlops can take no less than
+ *      max(numBytes / peakBandwidth, numFlops / peakFlops),
+ * and its attainment is that bound as a percentage of its actual duration.
+ */
+
+
+
+/* peaks */
+
+#define STREAM_SCALAR 3.0
+#define STREAM_NUM_KERNELS 5
+char* streamKernelNames[STREAM_NUM_KERNELS] = {"copy", "scale", "add", "triad", "update"};
+
+// independent vector accumulators per thread, enough to hide the FMA latency
+// without spilling registers, each of the widest available SIMD width
+#if defined(__AVX512F__)
+#define PEAK_FLOPS_WIDTH 8
+#elif defined(__AVX__)
+#define PEAK_FLOPS_WIDTH 4
+#else
+#define PEAK_FLOPS_WIDTH 2
+#endif
+#define PEAK_FLOPS_CHAINS 12     // as unrolled in getChainedFMAs
+#define PEAK_FLOPS_ITERS (1 << 24)
+
+typedef double PeakVector __attribute__((vector_size(PEAK_FLOPS_WIDTH * sizeof(double))));
+
+typedef struct {
+
+    double bandwidth;                           // GB/s, the best STREAM kernel
+    double streamBandwidths[STREAM_NUM_KERNELS];
+    double flops;                               // GFLOP/s
+
+} RooflinePeaks;
+
+void applyStreamKernel(int kernel, double* a, double* b, double* c, size_t n) {
+
+    size_t i;
+    switch (kernel) {
+        case 0:
+            #pragma omp parallel for shared(a,c,n) private(i) schedule(static)
+            for (i=0; i<n; i++)
+                c[i] = a[i];
+            break;
+        case 1:
+            #pragma omp parallel for shared(b,c,n) private(i) schedule(static)
+            for (i=0; i<n; i++)
+                b[i] = STREAM_SCALAR * c[i];
+            break;
+        case 2:
+            #pragma omp parallel for shared(a,b,c,n) private(i) schedule(static)
+            for (i=0; i<n; i++)
+                c[i] = a[i] + b[i];
+            break;
+        case 3:
+            #pragma omp parallel for shared(a,b,c,n) private(i) schedule(static)
+            for (i=0; i<n; i++)
+                a[i] = b[i] + STREAM_SCALAR * c[i];
+            break;
+        case 4:
+            #pragma omp parallel for shared(a,n) private(i) schedule(static)
+            for (i=0; i<n; i++)
+                a[i] = STREAM_SCALAR * a[i];
+            break;
+    }
+}
+
+double measureStreamBandwidth(int kernel, double* a, double* b, double* c, size_t n, int numReps) {
+
+    // STREAM counts only the explicit reads and writes, ignoring write-allocation
+    int numArrays[STREAM_NUM_KERNELS] = {2, 2, 3, 3, 2};
+    HarnessConfig cfg = {.numWarmups = 1, .numReps = numReps};
+    cfg.bytesPerRep = numArrays[kernel] * n * sizeof *a;
+
+    HarnessStats stats;
+    HARNESS_RUN(cfg, stats, , applyStreamKernel(kernel, a, b, c, n));
+
+    // STREAM reports the best repetition
+    return cfg.bytesPerRep / stats.min / 1E9;
+}
+
+double getChainedFMAs(double seed) {
+
+    // the chains are independent so the FMAs can pipeline, and are named rather
+    // than arrayed so that they are kept in registers at every optimisation level
+    PeakVector mul = (PeakVector) {} + 0.999999;
+    PeakVector add = (PeakVector) {} + 1E-6;
+    PeakVector a0 = (PeakVector) {} + seed, a1 = a0 + 1, a2 = a0 + 2, a3 = a0 + 3;
+    PeakVector a4 = a0 + 4, a5 = a0 + 5, a6 = a0 + 6, a7 = a0 + 7;
+    PeakVector a8 = a0 + 8, a9 = a0 + 9, a10 = a0 + 10, a11 = a0 + 11;
+
+    for (int i=0; i<PEAK_FLOPS_ITERS; i++) {
+        a0 = a0 * mul + add; a1 = a1 * mul + add; a2 = a2 * mul + add; a3 = a3 * mul + add;
+        a4 = a4 * mul + add; a5 = a5 * mul + add; a6 = a6 * mul + add; a7 = a7 * mul + add;
+        a8 = a8 * mul + add; a9 = a9 * mul + add; a10 = a10 * mul + add; a11 = a11 * mul + add;
+    }
+
+    // returned, so that the chains cannot be eliminated
+    PeakVector sum = a0 + a1 + a2 + a3 + a4 + a5 + a6 + a7 + a8 + a9 + a10 + a11;
+    double total = 0;
+    for (int l=0; l<PEAK_FLOPS_WIDTH; l++)
+        total += sum[l];
+    return total;
+}
+
+double measurePeakFlops(int numReps) {
+
+    double best = 0;
+
+    // the first repetition is a warm-up
+    for (int r=0; r<numReps+1; r++) {
+        int numThreads = 0;
+        double total = 0;
+
+        double start = getHarnessTime();
+        #pragma omp parallel reduction(+:numThreads,total)
+        {
+            numThreads += 1;
+            total += getChainedFMAs(r);
+        }
+        double dur = getHarnessTime() - start;
+
+        double rate = numThreads * 2.0 * PEAK_FLOPS_WIDTH * PEAK_FLOPS_CHAINS * PEAK_FLOPS_ITERS / dur / 1E9;
+        if (r > 0 && rate > best && total != 0)
+            best = rate;
+    }
+
+    return best;
+}
+
+RooflinePeaks measureRooflinePeaks(int numReps) {
+
+    RooflinePeaks peaks;
+
+    // each STREAM array is four times the LLC, first-touched by its users
+    size_t n = 2 * getFlushBytes() / sizeof(double);
+    double* a = malloc(n * sizeof *a);
+    double* b = malloc(n * sizeof *b);
+    double* c = malloc(n * sizeof *c);
+    size_t i;
+    #pragma omp parallel for shared(a,b,c,n) private(i) schedule(static)
+    for (i=0; i<n; i++) {
+        a[i] = 1;
+        b[i] = 2;
+        c[i] = 0;
+    }
+
+    peaks.bandwidth = 0;
+    for (int k=0; k<STREAM_NUM_KERNELS; k++) {
+        peaks.streamBandwidths[k] = measureStreamBandwidth(k, a, b, c, n, numReps);
+        if (peaks.streamBandwidths[k] > peaks.bandwidth)
+            peaks.bandwidth = peaks.streamBandwidths[k];
+    }
+
+    free(a);
+    free(b);
+    free(c);
+
+    peaks.flops = measurePeakFlops(numReps);
+    return peaks;
+}
+
+
+
+/* attainment */
+
+double getRooflineBound(RooflinePeaks peaks, double numBytes, double numFlops) {
+
+    // the shortest duration the host permits, in seconds
+    double memTime = numBytes / (peaks.bandwidth * 1E9);
+    double flopTime = numFlops / (peaks.flops * 1E9);
+    return (memTime > flopTime)? memTime : flopTime;
+}
+
+double getRooflineAttainment(RooflinePeaks peaks, double numBytes, double numFlops, double dur) {
+
+    // as a percentage
+    return 100 * getRooflineBound(peaks, numBytes, numFlops) / dur;
+}
+
+void printRooflinePeaks(RooflinePeaks peaks) {
+
+    printf("peak bandwidth: %.2f GB/s (", peaks.bandwidth);
+    for (int k=0; k<STREAM_NUM_KERNELS; k++)
+        printf("%s %.2f%s", streamKernelNames[k], peaks.streamBandwidths[k],
+            (k < STREAM_NUM_KERNELS-1)? ", " : ")\n");
+    printf("peak arithmetic: %.2f GFLOP/s\n", peaks.flops);
+    printf("ridge point: %.3f flops/byte\n\n", peaks.flops / peaks.bandwidth);
+}
+
+void writeRooflinePeaksToAssoc(FILE* file, RooflinePeaks peaks, int precision) {
+
+    writeDoubleToAssoc(file, "peakBandwidth", peaks.bandwidth, precision);
+    writeDoubleToAssoc(file, "peakFlops", peaks.flops, precision);
+    for (int k=0; k<STREAM_NUM_KERNELS; k++) {
+        char key[50];
+        sprintf(key, "stream_%s", streamKernelNames[k]);
+        writeDoubleToAssoc(file, key, peaks.streamBandwidths[k], precision);
+    }
+}
+
+
+
+#endif // ROOFLINE_H
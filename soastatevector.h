@@ -0,0 +1,428 @@
+#ifndef SOA_STATEVECTOR_H
+#define SOA_STATEVECTOR_H
+
+/* A structure-of-arrays statevector, which stores the real and imaginary
+ * components of the amplitudes in separate buffers, and explicitly vectorised
+ * kernels for the QFT gates upon it. Targets of at least SIMD_WIDTH_BITS pair
+ * whole vectors, while lower targets pair lanes within a single vector, which
+ * are permuted using shuffles specialised to each target.
+ *
+ * The AVX-512 or AVX2 kernels are chosen at compile-time (e.g. by -march=native),
+ * else the same kernels are compiled with a scalar "vector" of width 1.
+ */
+
+#include "utilities.h"
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+
+/* vector abstraction */
+
+#if defined(__AVX512F__)
+
+#define SIMD_WIDTH_BITS 3
+typedef __m512d vreal;
+typedef __mmask8 vmask;
+
+#define VLOAD(p)            _mm512_loadu_pd(p)
+#define VSTORE(p, v)        _mm512_storeu_pd(p, v)
+#define VSET1(x)            _mm512_set1_pd(x)
+#define VADD(a, b)          _mm512_add_pd(a, b)
+#define VSUB(a, b)          _mm512_sub_pd(a, b)
+#define VMUL(a, b)          _mm512_mul_pd(a, b)
+#define VBLEND(a, b, m)     _mm512_mask_blend_pd(m, a, b)
+#define VMASK(bits)         ((__mmask8) (bits))
+
+// exchange lanes which differ in bit 0, 1 or 2
+#define VPERM0(v)           _mm512_permute_pd(v, 0x55)
+#define VPERM1(v)           _mm512_permutex_pd(v, 0x4E)
+#define VPERM2(v)           _mm512_shuffle_f64x2(v, v, 0x4E)
+
+#elif defined(__AVX2__)
+
+#define SIMD_WIDTH_BITS 2
+typedef __m256d vreal;
+typedef __m256d vmask;
+
+#define VLOAD(p)            _mm256_loadu_pd(p)
+#define VSTORE(p, v)        _mm256_storeu_pd(p, v)
+#define VSET1(x)            _mm256_set1_pd(x)
+#define VADD(a, b)          _mm256_add_pd(a, b)
+#define VSUB(a, b)          _mm256_sub_pd(a, b)
+#define VMUL(a, b)          _mm256_mul_pd(a, b)
+#define VBLEND(a, b, m)     _mm256_blendv_pd(a, b, m)
+#define VMASK(bits)         _mm256_castsi256_pd(_mm256_set_epi64x( \
+                                -(((bits)>>3)&1), -(((bits)>>2)&1), -(((bits)>>1)&1), -((bits)&1)))
+
+#define VPERM0(v)           _mm256_permute_pd(v, 0x5)
+#define VPERM1(v)           _mm256_permute4x64_pd(v, 0x4E)
+
+#else
+
+#define SIMD_WIDTH_BITS 0
+typedef double vreal;
+typedef int vmask;
+
+#define VLOAD(p)            (*(p))
+#define VSTORE(p, v)        (*(p) = (v))
+#define VSET1(x)            (x)
+#define VADD(a, b)          ((a) + (b))
+#define VSUB(a, b)          ((a) - (b))
+#define VMUL(a, b)          ((a) * (b))
+#define VBLEND(a, b, m)     ((m)? (b) : (a))
+#define VMASK(bits)         ((bits) & 1)
+
+#endif
+
+#define SIMD_WIDTH (1 << SIMD_WIDTH_BITS)
+
+FORCE_INLINE int getLaneBits(int q) {
+
+    // bitmap of the lanes whose index has bit q set
+    int bits = 0;
+    for (int l=0; l<SIMD_WIDTH; l++)
+        bits |= getBit(l, q) << l;
+    return bits;
+}
+
+
+
+/* state-vector management */
+
+/* the statevector must contain at least SIMD_WIDTH amplitudes */
+
+typedef struct {
+
+    double* re;
+    double* im;
+    int numQubits;
+
+} SoAStatevector;
+
+SoAStatevector createSoAStatevector(int numQubits) {
+
+    // aligned_alloc requires the size be a multiple of the alignment
+    INDEX numBytes = pow2(numQubits) * sizeof(double);
+    if (numBytes < 64)
+        numBytes = 64;
+
+    SoAStatevector psi;
+    psi.numQubits = numQubits;
+    psi.re = aligned_alloc(64, numBytes);
+    psi.im = aligned_alloc(64, numBytes);
+    return psi;
+}
+
+void destroySoAStatevector(SoAStatevector* psi) {
+
+    free(psi->re);
+    free(psi->im);
+}
+
+void copyAoSToSoA(SoAStatevector* dest, amp* src) {
+
+    for (INDEX i=0; i<pow2(dest->numQubits); i++) {
+        dest->re[i] = creal(src[i]);
+        dest->im[i] = cimag(src[i]);
+    }
+}
+
+void copySoAToAoS(amp* dest, SoAStatevector* src) {
+
+    for (INDEX i=0; i<pow2(src->numQubits); i++)
+        dest[i] = src->re[i] + I*src->im[i];
+}
+
+
+
+/* complex arithmetic */
+
+FORCE_INLINE void applyVecPhase(double* re, double* im, vreal fr, vreal fi, vmask mask) {
+
+    // (r + i j)(fr + i fi), in the masked lanes only
+    vreal r = VLOAD(re);
+    vreal j = VLOAD(im);
+    VSTORE(re, VBLEND(r, VSUB(VMUL(r, fr), VMUL(j, fi)), mask));
+    VSTORE(im, VBLEND(j, VADD(VMUL(r, fi), VMUL(j, fr)), mask));
+}
+
+
+
+/* gates */
+
+#define SOA_LOW_HADAMARD_LOOP(VPERM) \
+    _Pragma("omp parallel for schedule(static)") \
+    for (INDEX i=0; i<numAmps; i+=SIMD_WIDTH) { \
+        vreal r = VLOAD(&psi->re[i]); \
+        vreal j = VLOAD(&psi->im[i]); \
+        VSTORE(&psi->re[i], VADD(VMUL(VPERM(r), fac), VMUL(r, sfac))); \
+        VSTORE(&psi->im[i], VADD(VMUL(VPERM(j), fac), VMUL(j, sfac))); \
+    }
+
+void applySoAHadamard(SoAStatevector* psi, int t) {
+
+    const int N = psi->numQubits;
+    const double f = 1/sqrt(2);
+    const vreal fac = VSET1(f);
+
+    // pairs of vectors |j>|0>|k> and |j>|1>|k>, where k spans >= 1 vector
+    if (t >= SIMD_WIDTH_BITS) {
+        const INDEX jNum = pow2(N-(t+1));
+        const INDEX kNum = pow2(t);
+
+        #pragma omp parallel for schedule(static) collapse(2)
+        for (INDEX j=0; j<jNum; j++) {
+            for (INDEX k=0; k<kNum; k+=SIMD_WIDTH) {
+                INDEX j0k = getZeroBitFromAffix(j, k, t);
+                INDEX j1k = flipBit(j0k, t);
+
+                vreal r0 = VLOAD(&psi->re[j0k]);
+                vreal r1 = VLOAD(&psi->re[j1k]);
+                VSTORE(&psi->re[j0k], VMUL(fac, VADD(r0, r1)));
+                VSTORE(&psi->re[j1k], VMUL(fac, VSUB(r0, r1)));
+
+                vreal i0 = VLOAD(&psi->im[j0k]);
+                vreal i1 = VLOAD(&psi->im[j1k]);
+                VSTORE(&psi->im[j0k], VMUL(fac, VADD(i0, i1)));
+                VSTORE(&psi->im[j1k], VMUL(fac, VSUB(i0, i1)));
+            }
+        }
+        return;
+    }
+
+#if SIMD_WIDTH_BITS > 0
+    // lanes in |0> become f(a0 + a1), and in |1> become f(a0 - a1) = f(perm - a1)
+    const INDEX numAmps = pow2(N);
+    vreal sfac = VBLEND(VSET1(f), VSET1(-f), VMASK(getLaneBits(t)));
+    switch (t) {
+        case 0: SOA_LOW_HADAMARD_LOOP(VPERM0); break;
+        case 1: SOA_LOW_HADAMARD_LOOP(VPERM1); break;
+#if SIMD_WIDTH_BITS > 2
+        case 2: SOA_LOW_HADAMARD_LOOP(VPERM2); break;
+#endif
+    }
+#endif
+}
+
+void applySoAControlledPhase(SoAStatevector* psi, int c, int t, double theta) {
+    const int t1 = (t < c)? t : c;
+    const int t2 = (c > t)? c : t;
+
+    const int N = psi->numQubits;
+    const int L = SIMD_WIDTH_BITS;
+    const vreal fr = VSET1(cos(theta));
+    const vreal fi = VSET1(sin(theta));
+
+    // qubits below L select lanes, and those above select whole vectors
+    int laneBits = pow2(SIMD_WIDTH)-1;
+    if (t1 < L) laneBits &= getLaneBits(t1);
+    if (t2 < L) laneBits &= getLaneBits(t2);
+    const vmask mask = VMASK(laneBits);
+
+    const int h1 = (t1 < L)? -1 : t1 - L;
+    const int h2 = (t2 < L)? -1 : t2 - L;
+    const INDEX vNum = pow2(N - L - (h1 >= 0) - (h2 >= 0));
+
+    #pragma omp parallel for schedule(static)
+    for (INDEX m=0; m<vNum; m++) {
+        INDEX v = m;
+        if (h1 >= 0) v = flipBit(insertZeroBit(v, h1), h1);
+        if (h2 >= 0) v = flipBit(insertZeroBit(v, h2), h2);
+
+        INDEX i = v << L;
+        applyVecPhase(&psi->re[i], &psi->im[i], fr, fi, mask);
+    }
+}
+
+#if SIMD_WIDTH_BITS > 0
+FORCE_INLINE vreal permuteLanes(vreal v, int t) {
+    switch (t) {
+#if SIMD_WIDTH_BITS > 2
+        case 2: return VPERM2(v);
+#endif
+        case 1: return VPERM1(v);
+        default: return VPERM0(v);
+    }
+}
+
+FORCE_INLINE vreal swapLaneBits(vreal v, int t1, int t2) {
+
+    // exchange lanes |1>|0> and |0>|1> of bits t2, t1 (both below SIMD_WIDTH_BITS)
+#if defined(__AVX512F__)
+    INDEX lanes[8];
+    for (int l=0; l<8; l++)
+        lanes[l] = (getBit(l, t1) == getBit(l, t2))? (INDEX) l : flipBit(flipBit(l, t1), t2);
+    __m512i ind = _mm512_set_epi64(
+        lanes[7], lanes[6], lanes[5], lanes[4], lanes[3], lanes[2], lanes[1], lanes[0]);
+    return _mm512_permutexvar_pd(ind, v);
+#else
+    // only bits 0 and 1 exist
+    return _mm256_permute4x64_pd(v, 0xD8);
+#endif
+}
+#endif
+
+void applySoASwap(SoAStatevector* psi, int t1, int t2) {
+    if (t1 > t2) {
+        int t = t1;
+        t1 = t2;
+        t2 = t;
+    }
+
+    const int N = psi->numQubits;
+    const int L = SIMD_WIDTH_BITS;
+    double* comps[2] = {psi->re, psi->im};
+
+    // |j>|0>|k>|1>|l> <-> |j>|1>|k>|0>|l> where l spans >= 1 vector
+    if (t1 >= L) {
+        const INDEX jNum = pow2(N-(t2+1));
+        const INDEX kNum = pow2(t2-(t1+1));
+        const INDEX lNum = pow2(t1);
+
+        #pragma omp parallel for schedule(static) collapse(3)
+        for (INDEX j=0; j<jNum; j++) {
+            for (INDEX k=0; k<kNum; k++) {
+                for (INDEX l=0; l<lNum; l+=SIMD_WIDTH) {
+                    INDEX j0k0l = getZeroBitsFromAffixes(j, k, l, t2, t1);
+                    INDEX j0k1l = flipBit(j0k0l, t1);
+                    INDEX j1k0l = flipBit(j0k0l, t2);
+
+                    for (int c=0; c<2; c++) {
+                        vreal a = VLOAD(&comps[c][j0k1l]);
+                        VSTORE(&comps[c][j0k1l], VLOAD(&comps[c][j1k0l]));
+                        VSTORE(&comps[c][j1k0l], a);
+                    }
+                }
+            }
+        }
+        return;
+    }
+
+#if SIMD_WIDTH_BITS > 0
+    // vectors a (bit t2 = 0) and b (bit t2 = 1) exchange their |1> and |0> lanes of t1
+    if (t2 >= L) {
+        const INDEX jNum = pow2(N-(t2+1));
+        const INDEX kNum = pow2(t2-L);
+        const vmask mask1 = VMASK(getLaneBits(t1));
+        const vmask mask0 = VMASK(~getLaneBits(t1));
+
+        #pragma omp parallel for schedule(static) collapse(2)
+        for (INDEX j=0; j<jNum; j++) {
+            for (INDEX k=0; k<kNum; k++) {
+                INDEX ia = (j << (t2+1)) | (k << L);
+                INDEX ib = flipBit(ia, t2);
+
+                for (int c=0; c<2; c++) {
+                    vreal a = VLOAD(&comps[c][ia]);
+                    vreal b = VLOAD(&comps[c][ib]);
+                    VSTORE(&comps[c][ia], VBLEND(a, permuteLanes(b, t1), mask1));
+                    VSTORE(&comps[c][ib], VBLEND(b, permuteLanes(a, t1), mask0));
+                }
+            }
+        }
+        return;
+    }
+
+    // both qubits are within every vector
+    const INDEX numAmps = pow2(N);
+    #pragma omp parallel for schedule(static)
+    for (INDEX i=0; i<numAmps; i+=SIMD_WIDTH)
+        for (int c=0; c<2; c++)
+            VSTORE(&comps[c][i], swapLaneBits(VLOAD(&comps[c][i]), t1, t2));
+#endif
+}
+
+/* the merged phases multiply consecutive vectors by consecutive phases, rotating
+ * the per-lane phase factors by e^(i pi W/2^tMax) between vectors, and resyncing
+ * them exactly every SOA_PHASE_RESYNC vectors to bound the accumulated error.
+ * Runs of at most SOA_PHASE_TABLE_MAX phases are instead tabulated once
+ */
+
+#define SOA_PHASE_RESYNC 16
+#define SOA_PHASE_TABLE_MAX 1024
+
+void applySoAMergedPhases(SoAStatevector* psi, int tMax) {
+
+    const int N = psi->numQubits;
+    const int L = SIMD_WIDTH_BITS;
+    const INDEX kNum = pow2(tMax);
+    const double fac = (M_PI / (double) kNum);
+
+    // every vector has the same phases (upon lanes with bit tMax)
+    if (tMax < L) {
+        double fr[SIMD_WIDTH], fi[SIMD_WIDTH];
+        for (int l=0; l<SIMD_WIDTH; l++) {
+            fr[l] = cos(fac * truncateBits(l, tMax));
+            fi[l] = sin(fac * truncateBits(l, tMax));
+        }
+        const vmask mask = VMASK(getLaneBits(tMax));
+        const INDEX numAmps = pow2(N);
+
+        #pragma omp parallel for schedule(static)
+        for (INDEX i=0; i<numAmps; i+=SIMD_WIDTH)
+            applyVecPhase(&psi->re[i], &psi->im[i], VLOAD(fr), VLOAD(fi), mask);
+        return;
+    }
+
+    const INDEX jNum = pow2(N-(tMax+1));
+    
+    // |j>|1>|k> where k spans few vectors, whose phases are tabulated once
+    if (kNum <= SOA_PHASE_TABLE_MAX) {
+        double fr[kNum], fi[kNum];
+        for (INDEX k=0; k<kNum; k++) {
+            fr[k] = cos(fac * k);
+            fi[k] = sin(fac * k);
+        }
+        const vmask all = VMASK(pow2(SIMD_WIDTH)-1);
+        
+        #pragma omp parallel for schedule(static) collapse(2)
+        for (INDEX j=0; j<jNum; j++) {
+            for (INDEX k=0; k<kNum; k+=SIMD_WIDTH) {
+                INDEX j1k = flipBit(getZeroBitFromAffix(j, k, tMax), tMax);
+                applyVecPhase(&psi->re[j1k], &psi->im[j1k], VLOAD(&fr[k]), VLOAD(&fi[k]), all);
+            }
+        }
+        return;
+    }
+
+    // otherwise k spans many vectors, processed in chunks of RESYNC vectors
+    const INDEX vNum = kNum >> L;
+    const INDEX cLen = (vNum < SOA_PHASE_RESYNC)? vNum : SOA_PHASE_RESYNC;
+    const INDEX cNum = vNum / cLen;
+    const vreal wr = VSET1(cos(fac * SIMD_WIDTH));
+    const vreal wi = VSET1(sin(fac * SIMD_WIDTH));
+    const vmask all = VMASK(pow2(SIMD_WIDTH)-1);
+
+    #pragma omp parallel for schedule(static) collapse(2)
+    for (INDEX j=0; j<jNum; j++) {
+        for (INDEX c=0; c<cNum; c++) {
+
+            INDEX k = c * cLen * SIMD_WIDTH;
+            INDEX j1k = flipBit(getZeroBitFromAffix(j, k, tMax), tMax);
+
+            double fr0[SIMD_WIDTH], fi0[SIMD_WIDTH];
+            for (int l=0; l<SIMD_WIDTH; l++) {
+                fr0[l] = cos(fac * (k + l));
+                fi0[l] = sin(fac * (k + l));
+            }
+            vreal fr = VLOAD(fr0);
+            vreal fi = VLOAD(fi0);
+
+            for (INDEX v=0; v<cLen; v++) {
+                INDEX i = j1k + v*SIMD_WIDTH;
+                applyVecPhase(&psi->re[i], &psi->im[i], fr, fi, all);
+
+                vreal nr = VSUB(VMUL(fr, wr), VMUL(fi, wi));
+                fi = VADD(VMUL(fr, wi), VMUL(fi, wr));
+                fr = nr;
+            }
+        }
+    }
+}
+
+
+
+#endif // SOA_STATEVECTOR_H
@@ -1,11 +1,26 @@
 #ifndef UTILITIES_H
 #define UTILITIES_H
 
+// exposes thread affinity and huge-page mapping, so must precede all includes
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <complex.h>
 #include <sys/time.h>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 
@@ -56,7 +71,26 @@ void getAverageAndVariance(double* data, int lenData, double *av, double *var) {
 
 typedef long long unsigned int INDEX;
 
+/* the precision of the amplitudes, chosen at compile-time by -DPRECISION=1 
+ * (single) or 2 (double, the default). Reductions like norms are always 
+ * accumulated in double, so single precision halves the memory traffic of 
+ * every kernel while losing little accuracy beyond the storage rounding
+ */
+#ifndef PRECISION
+#define PRECISION 2
+#endif
+
+#if PRECISION == 1
+typedef float qreal;
+typedef float complex amp;
+#define PRECISION_NAME "single"
+#elif PRECISION == 2
+typedef double qreal;
 typedef double complex amp;
+#define PRECISION_NAME "double"
+#else
+#error "PRECISION must be 1 (single) or 2 (double)"
+#endif
 
 FORCE_INLINE double getAbsSquared(amp val) {
     double r = creal(val);
@@ -111,6 +145,18 @@ FORCE_INLINE INDEX getZeroBitFromAffix(INDEX prefix, INDEX suffix, int i) {
     return (prefix << (i+1)) | suffix;
 }
 
+FORCE_INLINE INDEX reverseBits(INDEX num, int numBits) {
+    if (numBits == 0)
+        return 0;
+    num = ((num >>  1) & 0x5555555555555555ULL) | ((num & 0x5555555555555555ULL) <<  1);
+    num = ((num >>  2) & 0x3333333333333333ULL) | ((num & 0x3333333333333333ULL) <<  2);
+    num = ((num >>  4) & 0x0F0F0F0F0F0F0F0FULL) | ((num & 0x0F0F0F0F0F0F0F0FULL) <<  4);
+    num = ((num >>  8) & 0x00FF00FF00FF00FFULL) | ((num & 0x00FF00FF00FF00FFULL) <<  8);
+    num = ((num >> 16) & 0x0000FFFF0000FFFFULL) | ((num & 0x0000FFFF0000FFFFULL) << 16);
+    num = (num >> 32) | (num << 32);
+    return num >> (64 - numBits);
+}
+
 FORCE_INLINE INDEX getZeroBitsFromAffixes(INDEX prefix, INDEX infix, INDEX suffix, int t2, int t1) {
     return (prefix << (t2+1)) | (infix << (t1+1)) | suffix;
 } 
@@ -165,6 +211,59 @@ void getSortedRandomSubReg(int* ret, int SubRegSize, int RegSize) {
 
 
 
+/* counter-based randomness */
+
+/* the Philox4x32-10 generator (Salmon et al., 2011) maps a (counter, key) pair 
+ * to four independent random words, without any state. Amplitude i of a seeded
+ * statevector uses counter i and the seed as key, so can be generated by any 
+ * thread or rank in any order, giving the same state for any thread and rank
+ * count.
+ */
+
+#define PHILOX_M0 0xD2511F53U
+#define PHILOX_M1 0xCD9E8D57U
+#define PHILOX_W0 0x9E3779B9U
+#define PHILOX_W1 0xBB67AE85U
+#define PHILOX_ROUNDS 10
+
+FORCE_INLINE void getPhiloxWords(uint64_t counter, uint64_t key, uint32_t words[4]) {
+    
+    uint32_t c0 = (uint32_t) counter, c1 = (uint32_t) (counter >> 32), c2 = 0, c3 = 0;
+    uint32_t k0 = (uint32_t) key, k1 = (uint32_t) (key >> 32);
+    
+    for (int r=0; r<PHILOX_ROUNDS; r++) {
+        uint64_t p0 = (uint64_t) PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t) PHILOX_M1 * c2;
+        uint32_t n0 = (uint32_t) (p1 >> 32) ^ c1 ^ k0;
+        uint32_t n2 = (uint32_t) (p0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t) p1;
+        c3 = (uint32_t) p0;
+        c0 = n0;
+        c2 = n2;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    
+    words[0] = c0; words[1] = c1; words[2] = c2; words[3] = c3;
+}
+
+FORCE_INLINE double getDecimalFromWords(uint32_t hi, uint32_t lo) {
+    
+    // uniform in [-1, 1), from the upper 53 bits
+    uint64_t bits = ((uint64_t) hi << 32) | lo;
+    return 2 * ((bits >> 11) * 0x1.0p-53) - 1;
+}
+
+FORCE_INLINE amp getSeededComplex(uint64_t seed, INDEX i) {
+    
+    // uniform in the square [-1-i, 1+i), like getRandomComplex(-1-I, 1+I)
+    uint32_t w[4];
+    getPhiloxWords(i, seed, w);
+    return getDecimalFromWords(w[0], w[1]) + I*getDecimalFromWords(w[2], w[3]);
+}
+
+
+
 /* state-vector management */
 
 amp* createStatevector(int numQubits) {
@@ -191,10 +290,223 @@ void initRandomStatevector(amp* vec, int numQubits) {
 void initOnesStatevector(amp* vec, int numQubits) {
     
     INDEX numAmps = pow2(numQubits);
-    for (INDEX i=0; i<numAmps; i++)
+    INDEX i;
+    #pragma omp parallel for shared(vec,numAmps) private(i) schedule(static)
+    for (i=0; i<numAmps; i++)
         vec[i] = 1;
 }
 
+/* the norm of a seeded statevector is accumulated during generation as fixed-
+ * size block sums, which are added pairwise in a fixed tree. The result is hence
+ * bitwise independent of the thread count, and the blocks of a distributed 
+ * partition form a subtree so that it is also independent of the rank count, 
+ * provided every partition holds at least one block.
+ */
+
+#define NORM_BLOCK_QUBITS 10
+
+double getPairwiseSum(double* terms, INDEX numTerms) {
+    
+    // numTerms must be a power of 2; terms is overwritten
+    for (INDEX s=1; s<numTerms; s*=2) {
+        INDEX i;
+        #pragma omp parallel for shared(terms,numTerms,s) private(i) schedule(static)
+        for (i=0; i<numTerms; i+=2*s)
+            terms[i] += terms[i+s];
+    }
+    return terms[0];
+}
+
+double setSeededAmps(amp* vec, INDEX numAmps, INDEX firstIndex, uint64_t seed) {
+    
+    // writes vec[j] as amplitude (firstIndex + j) of the unnormalised state, returning its squared norm
+    INDEX blockSize = (numAmps < pow2(NORM_BLOCK_QUBITS))? numAmps : pow2(NORM_BLOCK_QUBITS);
+    INDEX numBlocks = numAmps / blockSize;
+    double* blockNorms = malloc(numBlocks * sizeof *blockNorms);
+    
+    INDEX b;
+    #pragma omp parallel for shared(vec,blockSize,numBlocks,blockNorms,firstIndex,seed) private(b) schedule(static)
+    for (b=0; b<numBlocks; b++) {
+        double norm = 0;
+        for (INDEX j=b*blockSize; j<(b+1)*blockSize; j++) {
+            vec[j] = getSeededComplex(seed, firstIndex + j);
+            norm += getAbsSquared(vec[j]);
+        }
+        blockNorms[b] = norm;
+    }
+    
+    double norm = getPairwiseSum(blockNorms, numBlocks);
+    free(blockNorms);
+    return norm;
+}
+
+void scaleStatevector(amp* vec, INDEX numAmps, double fac) {
+    
+    INDEX i;
+    #pragma omp parallel for shared(vec,numAmps,fac) private(i) schedule(static)
+    for (i=0; i<numAmps; i++)
+        vec[i] *= fac;
+}
+
+void initSeededStatevector(amp* vec, int numQubits, uint64_t seed) {
+    
+    // a parallel, reproducible alternative to initRandomStatevector, ignoring srand
+    INDEX numAmps = pow2(numQubits);
+    double norm = setSeededAmps(vec, numAmps, 0, seed);
+    scaleStatevector(vec, numAmps, 1/sqrt(norm));
+}
+
+void copyStatevector(amp* dest, amp* src, int numQubits) {
+    
+    INDEX numAmps = pow2(numQubits);
+    INDEX i;
+    #pragma omp parallel for shared(dest,src,numAmps) private(i) schedule(static)
+    for (i=0; i<numAmps; i++)
+        dest[i] = src[i];
+}
+
+double getMaxAbsDifference(amp* vec1, amp* vec2, int numQubits) {
+    
+    INDEX numAmps = pow2(numQubits);
+    double maxDiff = 0;
+    for (INDEX i=0; i<numAmps; i++) {
+        double diff = sqrt(getAbsSquared(vec1[i] - vec2[i]));
+        if (diff > maxDiff)
+            maxDiff = diff;
+    }
+    return maxDiff;
+}
+
+
+
+/* NUMA-aware state-vector management */
+
+/* the OS places each page upon the NUMA node of the thread which first writes 
+ * it, so a malloc'd statevector initialised serially lives entirely on one 
+ * socket, and half of every multithreaded kernel's traffic crosses the 
+ * interconnect. These allocators instead map the statevector (optionally 
+ * backed by huge pages, reducing TLB misses) and first-touch it in parallel 
+ * with the same schedule(static) partition as the kernels, so that each thread 
+ * mostly accesses pages local to its socket. This requires threads to stay on 
+ * their cores, which pinThreads() enforces; call it before allocating. Such 
+ * statevectors must be freed by destroyNumaStatevector(), not free().
+ */
+
+typedef enum {
+    PAGES_DEFAULT,
+    PAGES_TRANSPARENT_HUGE,     // merged into 2 MB pages by the kernel, when possible
+    PAGES_HUGE_2MB,             // reserved, requiring /proc/sys/vm/nr_hugepages
+    PAGES_HUGE_1GB              // reserved, requiring hugepagesz=1G at boot
+} PageKind;
+
+#ifdef __linux__
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+#endif
+
+size_t getNumaMappingSize(int numQubits) {
+    
+    // a multiple of the huge page size, and depending only on numQubits, so that
+    // destruction needn't know which page kind was obtained
+    size_t numBytes = pow2(numQubits) * sizeof(amp);
+    size_t pageSize = (numBytes >= (1ULL << 30))? (1ULL << 30) : (1ULL << 21);
+    return ((numBytes + pageSize - 1) / pageSize) * pageSize;
+}
+
+void firstTouchStatevector(amp* vec, int numQubits) {
+    
+    // must match the kernels' schedule(static) partition over amplitudes
+    INDEX numAmps = pow2(numQubits);
+    INDEX i;
+    #pragma omp parallel for shared(vec,numAmps) private(i) schedule(static)
+    for (i=0; i<numAmps; i++)
+        vec[i] = 0;
+}
+
+amp* createNumaStatevector(int numQubits, PageKind pages) {
+    
+    // falls back to smaller pages when the requested kind is unavailable
+#ifdef __linux__
+    size_t size = getNumaMappingSize(numQubits);
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void* vec = MAP_FAILED;
+    
+    // huge pages are reserved when mapped (no MAP_NORESERVE), so that an empty 
+    // pool fails here rather than faulting at first touch
+    if (pages == PAGES_HUGE_1GB && size % (1ULL << 30) == 0)
+        vec = mmap(NULL, size, PROT_READ|PROT_WRITE, flags | MAP_HUGETLB | MAP_HUGE_1GB, -1, 0);
+    if (vec == MAP_FAILED && pages >= PAGES_HUGE_2MB)
+        vec = mmap(NULL, size, PROT_READ|PROT_WRITE, flags | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+    if (vec == MAP_FAILED) {
+        vec = mmap(NULL, size, PROT_READ|PROT_WRITE, flags | MAP_NORESERVE, -1, 0);
+        if (vec == MAP_FAILED)
+            return NULL;
+        madvise(vec, size, (pages == PAGES_DEFAULT)? MADV_NOHUGEPAGE : MADV_HUGEPAGE);
+    }
+#else
+    amp* vec = createStatevector(numQubits);
+    if (vec == NULL)
+        return NULL;
+#endif
+    
+    firstTouchStatevector(vec, numQubits);
+    return vec;
+}
+
+void destroyNumaStatevector(amp* vec, int numQubits) {
+    
+#ifdef __linux__
+    munmap(vec, getNumaMappingSize(numQubits));
+#else
+    free(vec);
+#endif
+}
+
+int pinThreads(int spread) {
+    
+    /* binds each OpenMP thread to a single core of those available to the 
+     * process, either adjacently (spread=0) or spaced evenly over all cores 
+     * (spread=1) so that every socket is used. Threads persist between parallel 
+     * regions of the same size, so the pinning lasts until the thread count 
+     * changes. Returns 0 if affinity is unsupported, like OMP_PROC_BIND.
+     */
+#if defined(__linux__) && defined(_OPENMP)
+    cpu_set_t available;
+    if (sched_getaffinity(0, sizeof available, &available) != 0)
+        return 0;
+    
+    int numCpus = CPU_COUNT(&available);
+    int cpus[numCpus];
+    for (int c=0, n=0; n<numCpus; c++)
+        if (CPU_ISSET(c, &available))
+            cpus[n++] = c;
+    
+    int success = 1;
+    #pragma omp parallel shared(cpus,numCpus,spread) reduction(&&:success)
+    {
+        int id = omp_get_thread_num();
+        int numThreads = omp_get_num_threads();
+        int ind = (spread && numThreads < numCpus)? 
+            (id * numCpus) / numThreads : id % numCpus;
+        
+        cpu_set_t mine;
+        CPU_ZERO(&mine);
+        CPU_SET(cpus[ind], &mine);
+        success = (sched_setaffinity(0, sizeof mine, &mine) == 0);
+    }
+    return success;
+#else
+    return 0;
+#endif
+}
+
 
 
 /* printing */